@@ -0,0 +1,408 @@
+//
+// cloriSearch benchmark on synthetic workloads
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+// usage: clorisearch_bench [--key=value ...]
+//     --workloads=simple,interval,segment_tree,geo,mixed   workloads to run
+//     --ads=100000           number of ads
+//     --queries=10000        number of searches
+//     --fields=8             targeting fields of the simple and interval workloads
+//     --cardinality=1000     values per simple field / domain of interval fields
+//     --zipf=1.0             skew of the value popularity, 0 is uniform
+//     --conj_max=4           most conjunctions of one ad
+//     --conj_dist=uniform    conjunction size distribution, uniform or geometric
+//     --not_ratio=0.1        ratio of ∉ conjunctions
+//     --values=3             most values of one simple conjunction
+//     --interval_width=50    average width of a targeted interval
+//     --city=all             city the geo points are drawn from, e.g. beijing
+//     --points=2             most geo points of one ad
+//     --radius=5000          largest search radius in meter
+//     --compile=0            search on the compiled index
+//     --limit=-1             result limit of a search
+//     --seed=1
+//
+// every workload builds its own index and reports the build time, the
+// heap memory per posting and the search QPS and latency percentiles.
+// The same seed gives the same ads and queries
+//
+
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "clorisearch.h"
+
+using namespace cloris;
+
+struct BenchOptions {
+    std::string workloads = "simple,interval,segment_tree,geo,mixed";
+    int ads = 100000;
+    int queries = 10000;
+    int fields = 8;
+    int cardinality = 1000;
+    double zipf = 1.0;
+    int conj_max = 4;
+    std::string conj_dist = "uniform";
+    double not_ratio = 0.1;
+    int values = 3;
+    int interval_width = 50;
+    std::string city = "all";
+    int points = 2;
+    double radius = 5000;
+    bool compile = false;
+    int limit = -1;
+    uint64_t seed = 1;
+};
+
+// population (million) and spread of the urban area, points are drawn from
+// a gaussian around the center of a city picked by population
+struct City {
+    const char *name;
+    double lon;
+    double lat;
+    double population;
+    double sigma_km;
+};
+
+static const City g_cities[] = {
+    { "shanghai",  121.4737, 31.2304, 24.2, 15 },
+    { "beijing",   116.4074, 39.9042, 21.5, 15 },
+    { "chengdu",   104.0665, 30.5723, 16.3, 12 },
+    { "guangzhou", 113.2644, 23.1291, 14.9, 12 },
+    { "shenzhen",  114.0579, 22.5431, 13.0, 10 },
+    { "wuhan",     114.3055, 30.5928, 11.1, 10 },
+    { "hangzhou",  120.1551, 30.2741, 10.4, 10 },
+    { "xian",      108.9402, 34.3416, 10.0,  8 },
+};
+
+enum FieldKind {
+    FK_SIMPLE   = 0,
+    FK_INTERVAL = 1,
+    FK_GEO      = 2,
+};
+
+struct Field {
+    std::string name;
+    FieldKind kind;
+};
+
+class Workload {
+public:
+    Workload(const std::string& name, const BenchOptions& options);
+    bool valid() const { return !fields_.empty(); }
+    std::string Schema() const;
+    void GenerateAd(int docid, DNF& dnf, size_t& postings);
+    void GenerateQuery(Query& query);
+private:
+    int Zipf();
+    void GeoPoint(double& lon, double& lat);
+
+    BenchOptions options_;
+    std::string index_type_; // of the interval fields
+    std::vector<Field> fields_;
+    std::vector<double> zipf_cdf_;
+    std::vector<double> city_cdf_;
+    std::vector<const City*> cities_;
+    std::mt19937_64 rng_;
+};
+
+Workload::Workload(const std::string& name, const BenchOptions& options)
+    : options_(options), index_type_("interval"), rng_(options.seed) {
+    bool simple = (name == "simple" || name == "mixed");
+    bool interval = (name == "interval" || name == "segment_tree" || name == "mixed");
+    bool geo = (name == "geo" || name == "mixed");
+    if (name == "segment_tree") {
+        index_type_ = "segment_tree";
+    }
+    int n = (name == "mixed") ? std::max(options.fields / 2, 1) : options.fields;
+    for (int i = 0; simple && i < n; ++i) {
+        fields_.push_back(Field{ "s" + std::to_string(i), FK_SIMPLE });
+    }
+    for (int i = 0; interval && i < n; ++i) {
+        fields_.push_back(Field{ "i" + std::to_string(i), FK_INTERVAL });
+    }
+    if (geo) {
+        fields_.push_back(Field{ "loc", FK_GEO });
+    }
+
+    double sum = 0;
+    for (int i = 1; i <= options.cardinality; ++i) {
+        sum += 1.0 / pow(i, options.zipf);
+        zipf_cdf_.push_back(sum);
+    }
+    sum = 0;
+    for (auto& city : g_cities) {
+        if (options.city == "all" || options.city == city.name) {
+            sum += city.population;
+            city_cdf_.push_back(sum);
+            cities_.push_back(&city);
+        }
+    }
+    if (cities_.empty()) {
+        std::cerr << "unknown city " << options.city << ", all cities are used" << std::endl;
+        for (auto& city : g_cities) {
+            sum += city.population;
+            city_cdf_.push_back(sum);
+            cities_.push_back(&city);
+        }
+    }
+}
+
+std::string Workload::Schema() const {
+    std::stringstream ss;
+    ss << "{\"terms\":[";
+    for (size_t i = 0; i < fields_.size(); ++i) {
+        const Field& f = fields_[i];
+        ss << (i ? "," : "") << "{\"name\":\"" << f.name << "\",";
+        if (f.kind == FK_SIMPLE) {
+            ss << "\"key_type\":\"string\",\"index_type\":\"simple\"}";
+        } else if (f.kind == FK_INTERVAL) {
+            ss << "\"key_type\":\"int32\",\"index_type\":\"" << index_type_ << "\"";
+            if (index_type_ == "interval") {
+                ss << ",\"min_value\":0,\"max_value\":" << options_.cardinality - 1;
+            }
+            ss << "}";
+        } else {
+            ss << "\"key_type\":\"double\",\"index_type\":\"geo\"}";
+        }
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+// value rank in [0, cardinality), rank 0 is the most popular
+int Workload::Zipf() {
+    double u = std::uniform_real_distribution<double>(0, zipf_cdf_.back())(rng_);
+    return std::lower_bound(zipf_cdf_.begin(), zipf_cdf_.end(), u) - zipf_cdf_.begin();
+}
+
+void Workload::GeoPoint(double& lon, double& lat) {
+    double u = std::uniform_real_distribution<double>(0, city_cdf_.back())(rng_);
+    const City *city = cities_[std::lower_bound(city_cdf_.begin(), city_cdf_.end(), u) - city_cdf_.begin()];
+    std::normal_distribution<double> offset(0, city->sigma_km);
+    lat = city->lat + offset(rng_) / 111.32;
+    lon = city->lon + offset(rng_) / (111.32 * cos(city->lat * M_PI / 180));
+}
+
+void Workload::GenerateAd(int docid, DNF& dnf, size_t& postings) {
+    dnf.set_docid(docid);
+    dnf.set_mode("stanard");
+    int max_size = std::min(options_.conj_max, static_cast<int>(fields_.size()));
+    int size = 1;
+    if (options_.conj_dist == "geometric") {
+        while (size < max_size && std::bernoulli_distribution(0.5)(rng_)) {
+            ++size;
+        }
+    } else {
+        size = std::uniform_int_distribution<int>(1, max_size)(rng_);
+    }
+    std::vector<size_t> picked(fields_.size());
+    for (size_t i = 0; i < picked.size(); ++i) {
+        picked[i] = i;
+    }
+    std::shuffle(picked.begin(), picked.end(), rng_);
+
+    Disjunction *disjunction = dnf.add_disjunctions();
+    for (int i = 0; i < size; ++i) {
+        const Field& f = fields_[picked[i]];
+        Conjunction *conj = disjunction->add_conjunctions();
+        conj->set_name(f.name);
+        ConjValue *value = conj->mutable_value();
+        if (f.kind == FK_GEO) {
+            int n = std::uniform_int_distribution<int>(1, options_.points)(rng_);
+            for (int k = 0; k < n; ++k) {
+                double lon, lat;
+                this->GeoPoint(lon, lat);
+                value->add_geo_points(lon);
+                value->add_geo_points(lat);
+            }
+            postings += n;
+            continue;
+        }
+        conj->set_bt(!std::bernoulli_distribution(options_.not_ratio)(rng_));
+        if (f.kind == FK_SIMPLE) {
+            int n = std::uniform_int_distribution<int>(1, options_.values)(rng_);
+            for (int k = 0; k < n; ++k) {
+                value->add_sval("v" + std::to_string(this->Zipf()));
+            }
+            postings += n;
+        } else {
+            int width = std::uniform_int_distribution<int>(0, options_.interval_width * 2)(rng_);
+            int left = std::uniform_int_distribution<int>(0, std::max(options_.cardinality - width, 1) - 1)(rng_);
+            Int32Interval *intvl = value->add_int32_intvl();
+            intvl->set_left(left);
+            intvl->set_right(left + width);
+            intvl->set_flag(3); // []
+            postings += 1;
+        }
+    }
+}
+
+void Workload::GenerateQuery(Query& query) {
+    for (auto& f : fields_) {
+        if (f.kind == FK_SIMPLE) {
+            query[f.name] = "v" + std::to_string(this->Zipf());
+        } else if (f.kind == FK_INTERVAL) {
+            query[f.name] = std::uniform_int_distribution<int32_t>(0, options_.cardinality - 1)(rng_);
+        } else {
+            double lon, lat;
+            this->GeoPoint(lon, lat);
+            double radius = std::uniform_real_distribution<double>(options_.radius / 10, options_.radius)(rng_);
+            query[f.name] = GeoRange(lon, lat, radius);
+        }
+    }
+}
+
+// heap bytes in use, resident memory would also count pages freed by the
+// previous workload and kept by malloc
+static double HeapInUseMB() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    return (static_cast<double>(mi.uordblks) + mi.hblkhd) / 1048576.0;
+}
+
+static bool ParseOptions(int argc, char *argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char *eq = strchr(argv[i], '=');
+        if (strncmp(argv[i], "--", 2) != 0 || !eq) {
+            std::cerr << "bad argument " << argv[i] << std::endl;
+            return false;
+        }
+        std::string key(argv[i] + 2, eq - argv[i] - 2);
+        std::string value(eq + 1);
+        if (key == "workloads") {
+            options.workloads = value;
+        } else if (key == "ads") {
+            options.ads = std::stoi(value);
+        } else if (key == "queries") {
+            options.queries = std::stoi(value);
+        } else if (key == "fields") {
+            options.fields = std::stoi(value);
+        } else if (key == "cardinality") {
+            options.cardinality = std::stoi(value);
+        } else if (key == "zipf") {
+            options.zipf = std::stod(value);
+        } else if (key == "conj_max") {
+            options.conj_max = std::stoi(value);
+        } else if (key == "conj_dist") {
+            options.conj_dist = value;
+        } else if (key == "not_ratio") {
+            options.not_ratio = std::stod(value);
+        } else if (key == "values") {
+            options.values = std::stoi(value);
+        } else if (key == "interval_width") {
+            options.interval_width = std::stoi(value);
+        } else if (key == "city") {
+            options.city = value;
+        } else if (key == "points") {
+            options.points = std::stoi(value);
+        } else if (key == "radius") {
+            options.radius = std::stod(value);
+        } else if (key == "compile") {
+            options.compile = (value == "1" || value == "true");
+        } else if (key == "limit") {
+            options.limit = std::stoi(value);
+        } else if (key == "seed") {
+            options.seed = std::stoull(value);
+        } else {
+            std::cerr << "unknown option --" << key << std::endl;
+            return false;
+        }
+    }
+    if (options.ads <= 0 || options.queries <= 0 || options.fields <= 0 || options.cardinality <= 0 ||
+            options.conj_max <= 0 || options.values <= 0 || options.points <= 0 || options.interval_width < 0) {
+        std::cerr << "counts must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void RunWorkload(const std::string& name, const BenchOptions& options) {
+    Workload workload(name, options);
+    if (!workload.valid()) {
+        std::cerr << "unknown workload " << name << std::endl;
+        return;
+    }
+    CloriSearch sch;
+    if (!sch.Init(workload.Schema(), IndexSchemaFormat::ISF_JSON, SourceType::DIRECT)) {
+        std::cerr << "cloriSearch init failed, workload=" << name << std::endl;
+        return;
+    }
+
+    // ads are generated up front, only indexing is timed
+    std::vector<DNF> ads(options.ads);
+    size_t postings = 0;
+    for (int i = 0; i < options.ads; ++i) {
+        workload.GenerateAd(i + 1, ads[i], postings);
+    }
+    double heap_before = HeapInUseMB();
+    auto start = std::chrono::steady_clock::now();
+    for (auto& dnf : ads) {
+        sch.inverted_index()->Add(dnf, false);
+    }
+    if (options.compile) {
+        sch.Compile();
+    }
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    double index_mb = HeapInUseMB() - heap_before;
+    std::vector<DNF>().swap(ads);
+
+    std::vector<Query> queries(options.queries);
+    for (auto& query : queries) {
+        workload.GenerateQuery(query);
+    }
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    size_t hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto& query : queries) {
+        auto begin = std::chrono::steady_clock::now();
+        hits += sch.Search(query, options.limit).size();
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    double search_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[std::min(static_cast<size_t>(p * latencies.size()), latencies.size() - 1)];
+    };
+
+    printf("%-13s %9.1f %10.0f %9.1f %9.1f %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+            name.c_str(), build_ms, options.ads / (build_ms / 1000), index_mb,
+            postings ? index_mb * 1048576 / postings : 0.0,
+            queries.size() / search_s, percentile(0.5), percentile(0.9), percentile(0.99),
+            percentile(0.999), static_cast<double>(hits) / queries.size());
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+    printf("ads=%d queries=%d fields=%d cardinality=%d zipf=%.2f conj_max=%d(%s) not_ratio=%.2f "
+            "interval_width=%d city=%s points=%d radius=%.0f compile=%d seed=%lu\n",
+            options.ads, options.queries, options.fields, options.cardinality, options.zipf,
+            options.conj_max, options.conj_dist.c_str(), options.not_ratio, options.interval_width,
+            options.city.c_str(), options.points, options.radius, options.compile ? 1 : 0, options.seed);
+    printf("%-13s %9s %10s %9s %9s %10s %9s %9s %9s %9s %9s\n", "workload", "build_ms", "ads/s",
+            "index_mb", "B/posting", "qps", "p50_us", "p90_us", "p99_us", "p999_us", "hits");
+    std::stringstream ss(options.workloads);
+    std::string name;
+    while (std::getline(ss, name, ',')) {
+        if (!name.empty()) {
+            RunWorkload(name, options);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+//
+// cloriSearch microbenchmarks of the hot primitives
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+// built with -DWITH_MICROBENCH=ON, requires google benchmark
+//     ./clorisearch_microbench --benchmark_filter=Scorer
+//
+// inputs come from a fixed seed, so numbers of two builds are comparable
+//
+
+#include <math.h>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "json2pb/json2pb.h"
+#include "dnf_parser.h"
+#include "indexer/conjunction_scorer.h"
+#include "indexer/posting_list.h"
+#include "indexer/interval_indexer.h"
+#include "indexer/geo_indexer.h"
+#include "term.h"
+
+using namespace cloris;
+
+// 'length' sorted docids out of [0, length * spread)
+static std::list<DocidNode> RandomDocList(std::mt19937& rng, int length, int spread) {
+    std::vector<int> docids;
+    std::uniform_int_distribution<int> dist(0, length * spread - 1);
+    for (int i = 0; i < length; ++i) {
+        docids.push_back(dist(rng));
+    }
+    std::sort(docids.begin(), docids.end());
+    docids.erase(std::unique(docids.begin(), docids.end()), docids.end());
+    std::list<DocidNode> doc_list;
+    for (auto docid : docids) {
+        doc_list.push_back(DocidNode(docid, true));
+    }
+    return doc_list;
+}
+
+// args: number of lists, length of a list; a doc must be in half of the lists
+static void BM_ConjunctionScorer(benchmark::State& state) {
+    std::mt19937 rng(1);
+    int n = static_cast<int>(state.range(0));
+    std::vector<std::list<DocidNode>> lists;
+    for (int i = 0; i < n; ++i) {
+        lists.push_back(RandomDocList(rng, static_cast<int>(state.range(1)), 4));
+    }
+    size_t k = std::max(n / 2, 1);
+    size_t matched = 0;
+    for (auto _ : state) {
+        ConjunctionScorer scorer;
+        for (auto& l : lists) {
+            scorer.AddPostingList(&l, NULL);
+        }
+        std::vector<int> docids = scorer.GetMatchedDocid(k);
+        matched = docids.size();
+        benchmark::DoNotOptimize(docids.data());
+    }
+    state.counters["matched"] = matched;
+    state.SetItemsProcessed(state.iterations() * n * state.range(1));
+}
+BENCHMARK(BM_ConjunctionScorer)->ArgsProduct({ { 2, 8, 32 }, { 1000, 100000 } });
+
+// arg: skip distance in docids
+static void BM_PostingListSkipTo(benchmark::State& state) {
+    std::list<DocidNode> doc_list;
+    for (int i = 0; i < 1000000; ++i) {
+        doc_list.push_back(DocidNode(i * 2, true));
+    }
+    int distance = static_cast<int>(state.range(0));
+    PostingList pl(&doc_list, NULL);
+    int docid = 0;
+    for (auto _ : state) {
+        docid += distance;
+        pl.SkipTo(docid);
+        if (pl.CurrentEntry() == PostingList::EOL) {
+            state.PauseTiming();
+            pl = PostingList(&doc_list, NULL);
+            docid = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(pl.CurrentEntry());
+    }
+}
+BENCHMARK(BM_PostingListSkipTo)->Arg(2)->Arg(16)->Arg(256)->Arg(4096);
+
+// union cursor over a group, args: lists in the group, skip distance
+static void BM_PostingListUnionSkipTo(benchmark::State& state) {
+    std::mt19937 rng(2);
+    std::vector<std::list<DocidNode>> lists;
+    for (int i = 0; i < state.range(0); ++i) {
+        lists.push_back(RandomDocList(rng, 1000000 / static_cast<int>(state.range(0)), 2));
+    }
+    DocListGroup group;
+    for (auto& l : lists) {
+        group.push_back(&l);
+    }
+    int distance = static_cast<int>(state.range(1));
+    PostingList pl(group);
+    int docid = 0;
+    for (auto _ : state) {
+        docid += distance;
+        pl.SkipTo(docid);
+        if (pl.CurrentEntry() == PostingList::EOL) {
+            state.PauseTiming();
+            pl = PostingList(group);
+            docid = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(pl.CurrentEntry());
+    }
+}
+BENCHMARK(BM_PostingListUnionSkipTo)->ArgsProduct({ { 4, 64 }, { 2, 256 } });
+
+// overlapping intervals split the existing segments, arg: number of intervals
+static void AddRandomIntervals(IntervalIndexer<int32_t>& indexer, int n, std::mt19937& rng) {
+    std::uniform_int_distribution<int> left(0, 9900);
+    std::uniform_int_distribution<int> width(0, 100);
+    for (int docid = 0; docid < n; ++docid) {
+        ConjValue value;
+        Int32Interval *intvl = value.add_int32_intvl();
+        intvl->set_left(left(rng));
+        intvl->set_right(intvl->left() + width(rng));
+        intvl->set_flag(3);
+        indexer.Add(value, true, docid, false);
+    }
+}
+
+static void BM_IntervalIndexerAdd(benchmark::State& state) {
+    for (auto _ : state) {
+        std::mt19937 rng(3);
+        IntervalIndexer<int32_t> indexer("age");
+        AddRandomIntervals(indexer, static_cast<int>(state.range(0)), rng);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_IntervalIndexerAdd)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// args: number of intervals, query width (0 is a point), compiled or not
+static void BM_IntervalIndexerGetPostingLists(benchmark::State& state) {
+    std::mt19937 rng(4);
+    IntervalIndexer<int32_t> indexer("age");
+    AddRandomIntervals(indexer, static_cast<int>(state.range(0)), rng);
+    if (state.range(2)) {
+        indexer.Compile();
+    }
+    std::uniform_int_distribution<int> point(0, 9999);
+    std::vector<Term> terms;
+    for (int i = 0; i < 1024; ++i) {
+        int32_t left = point(rng);
+        if (state.range(1) == 0) {
+            terms.push_back(Term("age", left));
+        } else {
+            terms.push_back(Term("age", left, left + static_cast<int32_t>(state.range(1)), 3));
+        }
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        DocListGroup group;
+        indexer.GetPostingLists(terms[i++ & 1023], group);
+        benchmark::DoNotOptimize(group.data());
+    }
+}
+BENCHMARK(BM_IntervalIndexerGetPostingLists)->ArgsProduct({ { 10000 }, { 0, 100 }, { 0, 1 } });
+
+// 100k points around Beijing, args: radius in meter, compiled or not
+static void BM_GeoIndexerGetPostingLists(benchmark::State& state) {
+    std::mt19937 rng(5);
+    std::normal_distribution<double> offset(0, 0.15);
+    GeoIndexer indexer("location");
+    for (int docid = 0; docid < 100000; ++docid) {
+        ConjValue value;
+        value.add_geo_points(116.4074 + offset(rng));
+        value.add_geo_points(39.9042 + offset(rng));
+        indexer.Add(value, true, docid, false);
+    }
+    if (state.range(1)) {
+        indexer.Compile();
+    }
+    std::vector<Term> terms;
+    for (int i = 0; i < 1024; ++i) {
+        terms.push_back(Term(GeoRange(116.4074 + offset(rng), 39.9042 + offset(rng), state.range(0))));
+    }
+    size_t i = 0;
+    size_t lists = 0;
+    for (auto _ : state) {
+        DocListGroup group;
+        indexer.GetPostingLists(terms[i++ & 1023], group);
+        lists += group.size();
+    }
+    state.counters["lists"] = benchmark::Counter(lists, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_GeoIndexerGetPostingLists)->ArgsProduct({ { 500, 2000, 10000, 50000 }, { 0, 1 } });
+
+static void BM_TermConstruct(benchmark::State& state) {
+    std::string city("beijing");
+    int32_t age = 18;
+    for (auto _ : state) {
+        Term t1("age", age);
+        Term t2("city", city);
+        Term t3("age", age, age + 7, 3);
+        Term t4(GeoRange(116.4074, 39.9042, 2000));
+        benchmark::DoNotOptimize(t1.data());
+        benchmark::DoNotOptimize(t2.data());
+        benchmark::DoNotOptimize(t3.data());
+        benchmark::DoNotOptimize(t4.data());
+    }
+}
+BENCHMARK(BM_TermConstruct);
+
+static void BM_TermHash(benchmark::State& state) {
+    std::vector<Term> terms;
+    for (int i = 0; i < 1024; ++i) {
+        terms.push_back(Term("city", "city_" + std::to_string(i)));
+    }
+    TermHash hash;
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hash(terms[i++ & 1023]));
+    }
+}
+BENCHMARK(BM_TermHash);
+
+static const std::string g_dnf_str = "{\"mode\":\"stanard\",\"docid\":2,\"disjunctions\":[{\"conjunctions\":["
+    "{\"name\":\"city\",\"bt\":false,\"value\":{\"sval\":[\"beijing\",\"shanghai\",\"shenzhen\"]}},"
+    "{\"name\":\"device\",\"value\":{\"sval\":[\"ios\"]}},"
+    "{\"name\":\"net\",\"value\":{\"ival\":[1]}},"
+    "{\"name\":\"location\",\"value\":{\"geo\":{\"lon\":116.4074,\"lat\":39.9042}}},"
+    "{\"name\":\"age\",\"value\":{\"int32_intvl\":[{\"left\":10,\"right\":14,\"flag\":3},"
+    "{\"left\":22,\"right\":25,\"flag\":2}]}}]}]}";
+
+static void BM_Json2pbDNF(benchmark::State& state) {
+    std::string err_msg;
+    for (auto _ : state) {
+        DNF dnf;
+        if (!json2pb::JsonToProtoMessage(g_dnf_str, &dnf, &err_msg)) {
+            state.SkipWithError(err_msg.c_str());
+            break;
+        }
+        benchmark::DoNotOptimize(dnf.docid());
+    }
+    state.SetBytesProcessed(state.iterations() * g_dnf_str.size());
+}
+BENCHMARK(BM_Json2pbDNF);
+
+// the SAX parser used by CloriSearch::Add, with the DNF reused as in a bulk load
+static void BM_DNFParser(benchmark::State& state) {
+    DNFParser parser;
+    DNF dnf;
+    for (auto _ : state) {
+        if (!parser.Parse(g_dnf_str, &dnf)) {
+            state.SkipWithError(parser.error().c_str());
+            break;
+        }
+        benchmark::DoNotOptimize(dnf.docid());
+    }
+    state.SetBytesProcessed(state.iterations() * g_dnf_str.size());
+}
+BENCHMARK(BM_DNFParser);
+
+BENCHMARK_MAIN();
@@ -3,23 +3,43 @@
 // version: 1.0 
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <google/protobuf/io/coded_stream.h>
 #include "internal/log.h"
 #include "json2pb/json2pb.h"
+#include "dnf_parser.h"
 #include "clorisearch.h"
 
 namespace cloris {
 
 CloriSearch::CloriSearch()
-    : enable_persist_(false) 
+    : enable_persist_(false),
+      compaction_running_(false),
+      compact_interval_(0),
+      compaction_stopped_(false),
+      trace_sample_rate_(0),
+      search_count_(0)
 #ifdef ENABLE_PERSIST
       , db_meta_(NULL),
       db_inverted_list_(NULL) 
 #endif
 {
-
+    pthread_mutex_init(&compaction_mutex_, NULL);
+    pthread_cond_init(&compaction_cond_, NULL);
 }
 
 CloriSearch::~CloriSearch() {
+    this->StopCompaction();
+    pthread_cond_destroy(&compaction_cond_);
+    pthread_mutex_destroy(&compaction_mutex_);
 #ifdef ENABLE_PERSIST
     if (db_meta_) {
         delete db_meta_;
@@ -50,8 +70,8 @@ bool CloriSearch::Init(const std::string& source, IndexSchemaFormat format, Sour
         cLog(ERROR, "cloriSearch init failed: inverted_index init failed");
         return false;
     }
-    if (!forward_index()->Init()) {
-        cLog(ERROR, "cloriSearch init failed: forward_index init failed");
+    if (!forward_index()->Init(schema, err_msg)) {
+        cLog(ERROR, "cloriSearch init failed: forward_index init failed, %s", err_msg.c_str());
         return false;
     }
     cLog(INFO, "cloriSearch init success!");
@@ -64,6 +84,15 @@ bool CloriSearch::Init(const CloriSearchOptions& options) {
         this->enable_persist_ = options.enable_persistence;
         this->meta_dir_ = options.meta_dir;
         this->inverted_list_dir_ = options.inverted_list_dir;
+        this->trace_sample_rate_ = options.trace_sample_rate;
+        this->trace_handler_ = options.trace_handler;
+        if (options.fetch_latency_metrics) {
+            inverted_index()->set_metrics(&metrics_);
+        }
+        if (options.compact_interval > 0 && !this->StartCompaction(options.compact_interval)) {
+            cLog(ERROR, "cloriSearch init failed: compaction thread start failed");
+            return false;
+        }
 #ifdef ENABLE_PERSIT
         if (this->enable_persist_) {
             leveldb::Options options;
@@ -98,26 +127,300 @@ bool CloriSearch::PersistToDatabase(const DNF& dnf) {
 }
 
 bool CloriSearch::Add(const std::string& source, IndexSchemaFormat format, bool is_incremental) {
-    if (format != ISF_JSON) {
+    uint64_t start = Metrics::NowNanos();
+    // reused by the adds of a thread, see DNFParser
+    static thread_local DNFParser parser;
+    static thread_local DNF dnf;
+    if (format == ISF_JSON) {
+        if (!parser.Parse(source, &dnf)) {
+            cLog(ERROR, "CloriSearch load failed:%s", parser.error().c_str());
+            metrics_.RecordAdd(Metrics::NowNanos() - start, false);
+            return false;
+        }
+    } else if (format == ISF_PB) {
+        if (!dnf.ParseFromString(source)) {
+            cLog(ERROR, "CloriSearch load failed: bad serialized DNF");
+            metrics_.RecordAdd(Metrics::NowNanos() - start, false);
+            return false;
+        }
+    } else {
         cLog(ERROR, "unsupport format-style");
         return false;
     }
+    this->AddDNF(dnf, is_incremental, start);
+    return true;
+}
+
+size_t CloriSearch::AddStream(std::istream& in, bool is_incremental) {
+    DNFParser parser;
+    DNF dnf;
+    std::string line;
+    size_t line_num = 0;
+    size_t added = 0;
+    while (std::getline(in, line)) {
+        ++line_num;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        uint64_t start = Metrics::NowNanos();
+        if (!parser.Parse(line, &dnf)) {
+            cLog(WARN, "CloriSearch load failed at line %zu:%s", line_num, parser.error().c_str());
+            metrics_.RecordAdd(Metrics::NowNanos() - start, false);
+            continue;
+        }
+        this->AddDNF(dnf, is_incremental, start);
+        ++added;
+    }
+    return added;
+}
+
+size_t CloriSearch::AddDelimited(const char *data, size_t size, bool is_incremental) {
     DNF dnf;
-    std::string err_msg;
-    if (!json2pb::JsonToProtoMessage(source, &dnf, &err_msg)) {
-        cLog(ERROR, "CloriSearch load failed:%s", err_msg.c_str());
-        return false;
+    size_t offset = 0;
+    size_t added = 0;
+    while (offset < size) {
+        uint64_t start = Metrics::NowNanos();
+        // a coded stream per message, so its int sized limits never see the
+        // whole buffer. It reads the message in place, there is no copy
+        size_t remain = size - offset;
+        google::protobuf::io::CodedInputStream coded(reinterpret_cast<const uint8_t*>(data + offset),
+                static_cast<int>(std::min<size_t>(remain, std::numeric_limits<int>::max())));
+        uint32_t length = 0;
+        if (!coded.ReadVarint32(&length) || length > remain - coded.CurrentPosition()) {
+            cLog(ERROR, "CloriSearch load failed: truncated DNF at offset %zu", offset);
+            metrics_.RecordAdd(Metrics::NowNanos() - start, false);
+            break;
+        }
+        size_t next = offset + coded.CurrentPosition() + length;
+        google::protobuf::io::CodedInputStream::Limit limit = coded.PushLimit(static_cast<int>(length));
+        dnf.Clear();
+        bool ok = dnf.MergeFromCodedStream(&coded) && coded.ConsumedEntireMessage() && dnf.IsInitialized();
+        coded.PopLimit(limit);
+        if (ok) {
+            this->AddDNF(dnf, is_incremental, start);
+            ++added;
+        } else {
+            // the length prefix still delimits it, go on with the next one
+            cLog(WARN, "CloriSearch load failed: bad serialized DNF at offset %zu", offset);
+            metrics_.RecordAdd(Metrics::NowNanos() - start, false);
+        }
+        offset = next;
     }
-    inverted_index()->Add(dnf, is_incremental);
+    return added;
+}
+
+size_t CloriSearch::AddFile(const std::string& path, IndexSchemaFormat format, bool is_incremental) {
+    if (format == ISF_JSON) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            cLog(ERROR, "CloriSearch load failed: can't open %s", path.c_str());
+            return 0;
+        }
+        return this->AddStream(in, is_incremental);
+    }
+    if (format != ISF_PB) {
+        cLog(ERROR, "unsupport format-style");
+        return 0;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cLog(ERROR, "CloriSearch load failed: can't open %s, errno=%d", path.c_str(), errno);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        cLog(ERROR, "CloriSearch load failed: can't mmap %s, errno=%d", path.c_str(), errno);
+        return 0;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    size_t added = this->AddDelimited(static_cast<const char*>(data), st.st_size, is_incremental);
+    munmap(data, st.st_size);
+    return added;
+}
+
+void CloriSearch::AddDNF(const DNF& dnf, bool is_incremental, uint64_t start) {
+    {
+        WriteGuard guard(rwlock());
+        inverted_index()->Add(dnf, is_incremental);
+        forward_index()->Add(dnf);
+    }
+    metrics_.RecordAdd(Metrics::NowNanos() - start, true);
     // Data persistence
     if (this->enable_persistence()) {
         this->PersistToDatabase(dnf);
     }
-    return true;
+}
+
+void CloriSearch::Compile() {
+    WriteGuard guard(rwlock());
+    inverted_index()->Compile();
+}
+
+size_t CloriSearch::Compact() {
+    WriteGuard guard(rwlock());
+    metrics_.RecordCompaction();
+    return inverted_index()->Compact();
+}
+
+void CloriSearch::GetMetrics(MetricsSnapshot& snapshot) {
+    metrics_.Snapshot(snapshot);
+    ReadGuard guard(rwlock());
+    inverted_index()->GetStats(snapshot);
 }
 
 std::vector<int> CloriSearch::Search(const Query& query, int limit) {
-    return inverted_index()->Search(query, limit);
+    if (trace_sample_rate_ == 0 ||
+            search_count_.fetch_add(1, std::memory_order_relaxed) % trace_sample_rate_ != 0) {
+        uint64_t start = Metrics::NowNanos();
+        std::vector<int> ret;
+        {
+            ReadGuard guard(rwlock());
+            ret = inverted_index()->Search(query, limit);
+        }
+        metrics_.RecordSearch(Metrics::NowNanos() - start);
+        return ret;
+    }
+    QueryTrace trace;
+    std::vector<int> ret = this->Search(query, limit, &trace);
+    if (trace_handler_) {
+        trace_handler_(trace);
+    } else {
+        // sampling is opted in, so the trace bypasses the level filter of cLog
+        FormatOutput("CLORIS", INFO, __FILE__, __LINE__, "[TRACE] %s", trace.ToString().c_str());
+    }
+    return ret;
+}
+
+std::vector<int> CloriSearch::Search(const Query& query, int limit, QueryTrace *trace) {
+    if (trace) {
+        trace->Reset();
+    }
+    uint64_t start = Metrics::NowNanos();
+    std::vector<int> ret;
+    {
+        ReadGuard guard(rwlock());
+        ret = inverted_index()->Search(query, limit, trace);
+    }
+    metrics_.RecordSearch(Metrics::NowNanos() - start);
+    return ret;
+}
+
+std::vector<std::pair<int, double>> CloriSearch::SearchNearest(const Query& query, const std::string& name, size_t n,
+        QueryTrace *trace) {
+    if (trace) {
+        trace->Reset();
+    }
+    ReadGuard guard(rwlock());
+    return inverted_index()->SearchNearest(query, name, n, trace);
+}
+
+std::vector<std::pair<int, double>> CloriSearch::SearchTopK(const Query& query, const TopKOptions& options,
+        QueryTrace *trace) {
+    if (trace) {
+        trace->Reset();
+    }
+    uint64_t start = Metrics::NowNanos();
+    std::vector<std::pair<int, double>> ret;
+    {
+        ReadGuard guard(rwlock());
+        ScoreFunction score = options.score;
+        if (!score && !forward_index()->GetScoreFunction(options.field, score)) {
+            cLog(ERROR, "top-k search failed: no score function and no numeric forward field %s",
+                    options.field.c_str());
+            return ret;
+        }
+        PartitionBound bound;
+        if (options.partition_bounds) {
+            bound = options.bound;
+            if (!bound && options.score) {
+                cLog(WARN, "top-k search: no partition bound for a custom score, nothing is skipped");
+            } else if (!bound && forward_index()->loaded()) {
+                // the loaded values never went through InvertedIndex::Add
+                cLog(DEBUG, "top-k search: forward index was loaded, no partition is skipped");
+            } else if (!bound) {
+                // docs without the attribute score 0
+                InvertedIndex *iidx = inverted_index();
+                const std::string& field = options.field;
+                bound = [iidx, &field](size_t conjunctions) {
+                    return std::max(iidx->PartitionMax(conjunctions, field), 0.0);
+                };
+            }
+        }
+        ret = inverted_index()->SearchTopK(query, options.k, score, bound, trace);
+    }
+    metrics_.RecordSearch(Metrics::NowNanos() - start);
+    return ret;
+}
+
+std::vector<std::pair<int, double>> CloriSearch::SearchWeighted(const Query& query, size_t k, QueryTrace *trace) {
+    if (trace) {
+        trace->Reset();
+    }
+    uint64_t start = Metrics::NowNanos();
+    std::vector<std::pair<int, double>> ret;
+    {
+        ReadGuard guard(rwlock());
+        ret = inverted_index()->SearchWeighted(query, k, trace);
+    }
+    metrics_.RecordSearch(Metrics::NowNanos() - start);
+    return ret;
+}
+
+bool CloriSearch::StartCompaction(int interval) {
+    if (compaction_running_) {
+        return true;
+    }
+    compact_interval_ = interval;
+    compaction_stopped_ = false;
+    compaction_running_ = true;
+    if (pthread_create(&compaction_thread_, NULL, CloriSearch::CompactionRoutine, this) != 0) {
+        compaction_running_ = false;
+        return false;
+    }
+    return true;
+}
+
+void CloriSearch::StopCompaction() {
+    if (!compaction_running_) {
+        return;
+    }
+    pthread_mutex_lock(&compaction_mutex_);
+    compaction_stopped_ = true;
+    pthread_cond_signal(&compaction_cond_);
+    pthread_mutex_unlock(&compaction_mutex_);
+    pthread_join(compaction_thread_, NULL);
+    compaction_running_ = false;
+}
+
+void* CloriSearch::CompactionRoutine(void *arg) {
+    CloriSearch *sch = static_cast<CloriSearch*>(arg);
+    while (true) {
+        struct timeval now;
+        struct timespec deadline;
+        gettimeofday(&now, NULL);
+        deadline.tv_sec = now.tv_sec + sch->compact_interval_;
+        deadline.tv_nsec = now.tv_usec * 1000;
+
+        pthread_mutex_lock(&sch->compaction_mutex_);
+        while (!sch->compaction_stopped_) {
+            if (pthread_cond_timedwait(&sch->compaction_cond_, &sch->compaction_mutex_, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        bool stopped = sch->compaction_stopped_;
+        pthread_mutex_unlock(&sch->compaction_mutex_);
+        if (stopped) {
+            break;
+        }
+        sch->Compact();
+    }
+    return NULL;
 }
 
 } // namespace cloris
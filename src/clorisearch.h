@@ -10,6 +10,13 @@
 #ifdef ENABLE_PERSIST
     #include <leveldb/db.h>
 #endif
+#include <pthread.h>
+#include <atomic>
+#include <functional>
+#include <istream>
+#include "internal/metrics.h"
+#include "internal/query_trace.h"
+#include "internal/rwlock.h"
 #include "inverted_index.h"
 #include "forward_index.h"
 
@@ -28,12 +35,45 @@ enum SourceType {
 };
 
 struct CloriSearchOptions {
+    CloriSearchOptions() 
+        : format(ISF_JSON), 
+          source_type(DIRECT), 
+          enable_persistence(false), 
+          compact_interval(0),
+          trace_sample_rate(0),
+          fetch_latency_metrics(false) {}
     std::string source;
     IndexSchemaFormat format;
     SourceType source_type;
     bool enable_persistence;
     std::string meta_dir;
     std::string inverted_list_dir;
+    // in seconds, compact the index in a background thread periodically,
+    // 0 means disabled. Add/Search are guarded by a read-write lock once enabled
+    int compact_interval;
+    // trace one of every 'trace_sample_rate' searches, 0 means disabled.
+    // sampled traces go to 'trace_handler', or are logged if it is empty
+    uint64_t trace_sample_rate;
+    std::function<void(const QueryTrace&)> trace_handler;
+    // time the posting list fetch of every query term into a histogram of its
+    // field, costs two clock reads per term
+    bool fetch_latency_metrics;
+};
+
+struct TopKOptions {
+    TopKOptions() : k(100), partition_bounds(false) {}
+    size_t k;
+    // docs are scored by forward index field 'field' (int64 or double), or
+    // by 'score' if it is set, e.g. bid * pCTR
+    std::string field;
+    ScoreFunction score;
+    // skip the partitions whose score bound can't beat the k-th score. The
+    // bound is 'bound' if set, otherwise the max of 'field' in the partition
+    // when scoring by 'field'. That one only holds if every doc carries its
+    // attributes in the DNF it is added with, see InvertedIndex::PartitionMax,
+    // so it is off once the forward index was loaded from a file
+    bool partition_bounds;
+    PartitionBound bound;
 };
 
 class CloriSearch {
@@ -43,9 +83,46 @@ public:
 
     bool Init(const std::string& source, IndexSchemaFormat format, SourceType source_type = DIRECT);
     bool Init(const CloriSearchOptions& options);
+    // 'source' is a DNF in json (ISF_JSON) or serialized protobuf (ISF_PB)
     bool Add(const std::string& source, IndexSchemaFormat format, bool is_incremental = false);
+    // bulk loads, bad DNFs are logged and counted as failed adds and the load
+    // goes on. They return the number of DNFs added
+    // newline delimited json, one DNF per line, blank lines are skipped
+    size_t AddStream(std::istream& in, bool is_incremental = false);
+    // serialized DNFs each prefixed with its varint32 length, as written by
+    // CodedOutputStream::WriteVarint32 and SerializeToCodedStream
+    size_t AddDelimited(const char *data, size_t size, bool is_incremental = false);
+    // ISF_JSON as AddStream, ISF_PB as AddDelimited over the mmapped file
+    size_t AddFile(const std::string& path, IndexSchemaFormat format, bool is_incremental = false);
     bool PersistToDatabase(const DNF& dnf);
     std::vector<int> Search(const Query& query, int limit = -1);
+    // traced into 'trace' regardless of the sample rate, it is reset first
+    std::vector<int> Search(const Query& query, int limit, QueryTrace *trace);
+    // nearest 'n' matched docs to the point of geo term 'name' with their
+    // distances, e.g. query["location"] = GeoRange(lon, lat), see InvertedIndex
+    // traced into 'trace' if it is not NULL, it is reset first
+    std::vector<std::pair<int, double>> SearchNearest(const Query& query, const std::string& name, size_t n,
+            QueryTrace *trace = NULL);
+    // the best 'options.k' matched docs as (docid, score) pairs, best first.
+    // Matches go into a bounded heap instead of a full result list
+    std::vector<std::pair<int, double>> SearchTopK(const Query& query, const TopKOptions& options,
+            QueryTrace *trace = NULL);
+    // the best 'k' matched docs by conjunction weight times query term weight,
+    // see InvertedIndex::SearchWeighted. Set the weights by Conjunction.weight
+    // when adding and Term::set_weight in the query
+    std::vector<std::pair<int, double>> SearchWeighted(const Query& query, size_t k, QueryTrace *trace = NULL);
+    void Compile();
+    size_t Compact();
+    // counters and latencies of Add/Search, and the index sizes which are
+    // collected by walking the index under the read lock
+    void GetMetrics(MetricsSnapshot& snapshot);
+    // forward index values of field 'name' for the matched docs, T is int64_t,
+    // double or std::string as declared, see ForwardIndex::Fetch
+    template <typename T>
+    bool Fetch(const std::vector<int>& docids, const std::string& name, std::vector<T>& values) {
+        ReadGuard guard(rwlock());
+        return forward_index()->Fetch(docids, name, values);
+    }
 
     inline InvertedIndex* inverted_index() { return &iidx_; }
     inline ForwardIndex*  forward_index()  { return &fidx_; }
@@ -53,11 +130,30 @@ public:
     inline const std::string& meta_dir() const     { return meta_dir_; }
     inline const std::string& inverted_list_dir() const { return inverted_list_dir_; }
 private:
+    static void* CompactionRoutine(void *arg);
+    bool StartCompaction(int interval);
+    void StopCompaction();
+    // index a parsed DNF, 'start' is when its add began
+    void AddDNF(const DNF& dnf, bool is_incremental, uint64_t start);
+    // NULL unless background compaction is running
+    inline RWLock* rwlock() { return compaction_running_ ? &rwlock_ : NULL; }
+
     InvertedIndex iidx_;
     ForwardIndex fidx_;
     bool enable_persist_;
     std::string meta_dir_;
     std::string inverted_list_dir_;
+    RWLock rwlock_;
+    bool compaction_running_;
+    int compact_interval_;
+    bool compaction_stopped_;
+    pthread_t compaction_thread_;
+    pthread_mutex_t compaction_mutex_;
+    pthread_cond_t compaction_cond_;
+    uint64_t trace_sample_rate_;
+    std::function<void(const QueryTrace&)> trace_handler_;
+    std::atomic<uint64_t> search_count_;
+    Metrics metrics_;
 #ifdef ENABLE_PERSIST    
     leveldb::DB *db_meta_;
     leveldb::DB *db_inverted_list_;
@@ -0,0 +1,498 @@
+//
+// streaming DNF json parser implementation
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <string.h>
+#include <limits>
+#include <vector>
+#include "json2pb/rapidjson.h"
+#include "butil/third_party/rapidjson/error/en.h"
+#include "dnf_parser.h"
+
+namespace cloris {
+
+namespace {
+
+// messages of a DNF, plus the frames of an array and of a skipped value
+enum FrameKind {
+    K_DNF,
+    K_DISJUNCTION,
+    K_CONJUNCTION,
+    K_CONJ_VALUE,
+    K_INT32_INTVL,
+    K_DOUBLE_INTVL,
+    K_STRING_INTVL,
+    K_GEO,
+    K_GEO_CIRCLE,
+    K_GEO_POLYGON,
+    K_ATTRIBUTE,
+    K_ARRAY,
+    K_SKIP,
+};
+
+enum Field {
+    F_NONE,
+    F_SKIP,
+    F_DOCID,
+    F_MODE,
+    F_DISJUNCTIONS,
+    F_ATTRIBUTES,
+    F_CONJUNCTIONS,
+    F_NAME,
+    F_BT,
+    F_VALUE,
+    F_WEIGHT,
+    F_SVAL,
+    F_IVAL,
+    F_DVAL,
+    F_INT32_INTVL,
+    F_DOUBLE_INTVL,
+    F_STRING_INTVL,
+    F_BVAL,
+    F_GEO,
+    F_GEO_CIRCLE,
+    F_GEO_POLYGON,
+    F_GEOS,
+    F_GEO_POINTS,
+    F_POINTS,
+    F_LEFT,
+    F_RIGHT,
+    F_FLAG,
+    F_LON,
+    F_LAT,
+    F_RADIUS,
+    F_ATTR_NAME,
+    F_ATTR_IVAL,
+    F_ATTR_DVAL,
+    F_ATTR_SVAL,
+};
+
+struct FieldName {
+    FrameKind kind;
+    const char *name;
+    Field field;
+};
+
+static const FieldName g_fields[] = {
+    { K_DNF,            "docid",        F_DOCID },
+    { K_DNF,            "mode",         F_MODE },
+    { K_DNF,            "disjunctions", F_DISJUNCTIONS },
+    { K_DNF,            "attributes",   F_ATTRIBUTES },
+    { K_DISJUNCTION,    "conjunctions", F_CONJUNCTIONS },
+    { K_CONJUNCTION,    "name",         F_NAME },
+    { K_CONJUNCTION,    "bt",           F_BT },
+    { K_CONJUNCTION,    "value",        F_VALUE },
+    { K_CONJUNCTION,    "weight",       F_WEIGHT },
+    { K_CONJ_VALUE,     "sval",         F_SVAL },
+    { K_CONJ_VALUE,     "ival",         F_IVAL },
+    { K_CONJ_VALUE,     "dval",         F_DVAL },
+    { K_CONJ_VALUE,     "int32_intvl",  F_INT32_INTVL },
+    { K_CONJ_VALUE,     "double_intvl", F_DOUBLE_INTVL },
+    { K_CONJ_VALUE,     "string_intvl", F_STRING_INTVL },
+    { K_CONJ_VALUE,     "bval",         F_BVAL },
+    { K_CONJ_VALUE,     "geo",          F_GEO },
+    { K_CONJ_VALUE,     "geo_circle",   F_GEO_CIRCLE },
+    { K_CONJ_VALUE,     "geo_polygon",  F_GEO_POLYGON },
+    { K_CONJ_VALUE,     "geos",         F_GEOS },
+    { K_CONJ_VALUE,     "geo_points",   F_GEO_POINTS },
+    { K_INT32_INTVL,    "left",         F_LEFT },
+    { K_INT32_INTVL,    "right",        F_RIGHT },
+    { K_INT32_INTVL,    "flag",         F_FLAG },
+    { K_DOUBLE_INTVL,   "left",         F_LEFT },
+    { K_DOUBLE_INTVL,   "right",        F_RIGHT },
+    { K_DOUBLE_INTVL,   "flag",         F_FLAG },
+    { K_STRING_INTVL,   "left",         F_LEFT },
+    { K_STRING_INTVL,   "right",        F_RIGHT },
+    { K_STRING_INTVL,   "flag",         F_FLAG },
+    { K_GEO,            "lon",          F_LON },
+    { K_GEO,            "lat",          F_LAT },
+    { K_GEO_CIRCLE,     "lon",          F_LON },
+    { K_GEO_CIRCLE,     "lat",          F_LAT },
+    { K_GEO_CIRCLE,     "radius",       F_RADIUS },
+    { K_GEO_POLYGON,    "points",       F_POINTS },
+    { K_ATTRIBUTE,      "name",         F_ATTR_NAME },
+    { K_ATTRIBUTE,      "ival",         F_ATTR_IVAL },
+    { K_ATTRIBUTE,      "dval",         F_ATTR_DVAL },
+    { K_ATTRIBUTE,      "sval",         F_ATTR_SVAL },
+};
+
+struct Frame {
+    Frame(FrameKind _kind, google::protobuf::Message *_msg, Field _field)
+        : kind(_kind), msg(_msg), field(_field) {}
+    FrameKind kind;
+    google::protobuf::Message *msg;
+    Field field; // the field of an array, the pending key of an object
+};
+
+//
+// rapidjson SAX handler filling a DNF. Objects and arrays push a frame,
+// a key sets the field its value goes to, values of unknown keys are
+// skipped whatever their shape
+//
+class DNFHandler {
+public:
+    explicit DNFHandler(std::string *err) : dnf_(NULL), err_(err) {}
+    void Reset(DNF *dnf) {
+        dnf_ = dnf;
+        stack_.clear();
+    }
+
+    // a null is taken as an absent field
+    bool Null() { return true; }
+    bool Bool(bool b);
+    bool AddInt(int i) { return Number(i, i, true); }
+    bool AddUint(unsigned i) { return Number(i, i, true); }
+    bool AddInt64(int64_t i) { return Number(i, static_cast<double>(i), true); }
+    bool AddUint64(uint64_t i) {
+        if (i > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+            return Number(0, static_cast<double>(i), false);
+        }
+        return Number(static_cast<int64_t>(i), static_cast<double>(i), true);
+    }
+    bool Double(double d) { return Number(0, d, false); }
+    bool String(const char *str, butil::rapidjson::SizeType length, bool copy);
+    bool StartObject();
+    bool Key(const char *str, butil::rapidjson::SizeType length, bool copy);
+    bool EndObject(butil::rapidjson::SizeType) { stack_.pop_back(); return true; }
+    bool StartArray();
+    bool EndArray(butil::rapidjson::SizeType) { stack_.pop_back(); return true; }
+private:
+    // field of the value being read, F_SKIP for values of unknown keys
+    Field CurrentField() const {
+        if (stack_.empty()) {
+            return F_NONE;
+        }
+        return (stack_.back().kind == K_SKIP) ? F_SKIP : stack_.back().field;
+    }
+    google::protobuf::Message* CurrentMessage() const { return stack_.back().msg; }
+    FrameKind CurrentKind() const {
+        return (stack_.back().kind == K_ARRAY) ? stack_[stack_.size() - 2].kind : stack_.back().kind;
+    }
+    // scalars only appear inside a message or an array, true if this one is
+    // to be ignored, 'ok' tells whether parsing goes on then
+    bool Skipped(bool *ok) {
+        if (stack_.empty()) {
+            *ok = Fail("object expected");
+            return true;
+        }
+        *ok = true;
+        return CurrentField() == F_SKIP;
+    }
+    bool Number(int64_t i, double d, bool is_int);
+    bool Fail(const char *what);
+
+    DNF *dnf_;
+    std::string *err_;
+    std::vector<Frame> stack_;
+};
+
+bool DNFHandler::Fail(const char *what) {
+    const char *field = "";
+    for (auto& p : g_fields) {
+        if (!stack_.empty() && p.field == CurrentField()) {
+            field = p.name;
+            break;
+        }
+    }
+    *err_ = std::string(what) + (*field ? std::string(" for field ") + field : std::string());
+    return false;
+}
+
+bool DNFHandler::Bool(bool b) {
+    bool ok;
+    if (Skipped(&ok)) {
+        return ok;
+    }
+    switch (CurrentField()) {
+    case F_BT:
+        static_cast<Conjunction*>(CurrentMessage())->set_bt(b);
+        return true;
+    case F_BVAL:
+        static_cast<ConjValue*>(CurrentMessage())->set_bval(b);
+        return true;
+    default:
+        return Fail("unexpected bool");
+    }
+}
+
+bool DNFHandler::Number(int64_t i, double d, bool is_int) {
+    bool ok;
+    if (Skipped(&ok)) {
+        return ok;
+    }
+    Field field = CurrentField();
+    google::protobuf::Message *msg = CurrentMessage();
+    FrameKind kind = CurrentKind();
+    bool is_int32 = is_int && i >= std::numeric_limits<int32_t>::min() && i <= std::numeric_limits<int32_t>::max();
+    switch (field) {
+    case F_DOCID:
+        if (!is_int32) {
+            return Fail("int32 expected");
+        }
+        static_cast<DNF*>(msg)->set_docid(static_cast<int32_t>(i));
+        return true;
+    case F_IVAL:
+        if (!is_int32) {
+            return Fail("int32 expected");
+        }
+        static_cast<ConjValue*>(msg)->add_ival(static_cast<int32_t>(i));
+        return true;
+    case F_DVAL:
+        static_cast<ConjValue*>(msg)->add_dval(d);
+        return true;
+    case F_GEO_POINTS:
+        static_cast<ConjValue*>(msg)->add_geo_points(d);
+        return true;
+    case F_FLAG:
+        if (!is_int32) {
+            return Fail("int32 expected");
+        }
+        if (kind == K_INT32_INTVL) {
+            static_cast<Int32Interval*>(msg)->set_flag(static_cast<int32_t>(i));
+        } else if (kind == K_DOUBLE_INTVL) {
+            static_cast<DoubleInterval*>(msg)->set_flag(static_cast<int32_t>(i));
+        } else {
+            static_cast<StringInterval*>(msg)->set_flag(static_cast<int32_t>(i));
+        }
+        return true;
+    case F_LEFT:
+    case F_RIGHT:
+        if (kind == K_INT32_INTVL) {
+            if (!is_int32) {
+                return Fail("int32 expected");
+            }
+            Int32Interval *intvl = static_cast<Int32Interval*>(msg);
+            (field == F_LEFT) ? intvl->set_left(static_cast<int32_t>(i)) : intvl->set_right(static_cast<int32_t>(i));
+            return true;
+        } else if (kind == K_DOUBLE_INTVL) {
+            DoubleInterval *intvl = static_cast<DoubleInterval*>(msg);
+            (field == F_LEFT) ? intvl->set_left(d) : intvl->set_right(d);
+            return true;
+        }
+        return Fail("string expected");
+    case F_LON:
+    case F_LAT:
+        if (kind == K_GEO) {
+            Geo *geo = static_cast<Geo*>(msg);
+            (field == F_LON) ? geo->set_lon(static_cast<float>(d)) : geo->set_lat(static_cast<float>(d));
+        } else {
+            GeoCircle *circle = static_cast<GeoCircle*>(msg);
+            (field == F_LON) ? circle->set_lon(d) : circle->set_lat(d);
+        }
+        return true;
+    case F_RADIUS:
+        static_cast<GeoCircle*>(msg)->set_radius(d);
+        return true;
+    case F_WEIGHT:
+        static_cast<Conjunction*>(msg)->set_weight(d);
+        return true;
+    case F_ATTR_IVAL:
+        if (!is_int) {
+            return Fail("int64 expected");
+        }
+        static_cast<Attribute*>(msg)->set_ival(i);
+        return true;
+    case F_ATTR_DVAL:
+        static_cast<Attribute*>(msg)->set_dval(d);
+        return true;
+    default:
+        return Fail("unexpected number");
+    }
+}
+
+bool DNFHandler::String(const char *str, butil::rapidjson::SizeType length, bool copy) {
+    bool ok;
+    if (Skipped(&ok)) {
+        return ok;
+    }
+    google::protobuf::Message *msg = CurrentMessage();
+    switch (CurrentField()) {
+    case F_MODE:
+        static_cast<DNF*>(msg)->set_mode(str, length);
+        return true;
+    case F_NAME:
+        static_cast<Conjunction*>(msg)->set_name(str, length);
+        return true;
+    case F_SVAL:
+        static_cast<ConjValue*>(msg)->add_sval(str, length);
+        return true;
+    case F_ATTR_NAME:
+        static_cast<Attribute*>(msg)->set_name(str, length);
+        return true;
+    case F_ATTR_SVAL:
+        static_cast<Attribute*>(msg)->set_sval(str, length);
+        return true;
+    case F_LEFT:
+    case F_RIGHT:
+        if (CurrentKind() == K_STRING_INTVL) {
+            StringInterval *intvl = static_cast<StringInterval*>(msg);
+            if (CurrentField() == F_LEFT) {
+                intvl->set_left(str, length);
+            } else {
+                intvl->set_right(str, length);
+            }
+            return true;
+        }
+        return Fail("number expected");
+    default:
+        return Fail("unexpected string");
+    }
+}
+
+bool DNFHandler::Key(const char *str, butil::rapidjson::SizeType length, bool copy) {
+    Frame& frame = stack_.back();
+    if (frame.kind == K_SKIP) {
+        return true;
+    }
+    frame.field = F_SKIP;
+    for (auto& p : g_fields) {
+        if (p.kind == frame.kind && strlen(p.name) == length && memcmp(p.name, str, length) == 0) {
+            frame.field = p.field;
+            break;
+        }
+    }
+    return true;
+}
+
+bool DNFHandler::StartObject() {
+    if (stack_.empty()) {
+        stack_.push_back(Frame(K_DNF, dnf_, F_NONE));
+        return true;
+    }
+    google::protobuf::Message *msg = CurrentMessage();
+    switch (CurrentField()) {
+    case F_SKIP:
+        stack_.push_back(Frame(K_SKIP, NULL, F_SKIP));
+        return true;
+    case F_DISJUNCTIONS:
+        stack_.push_back(Frame(K_DISJUNCTION, static_cast<DNF*>(msg)->add_disjunctions(), F_NONE));
+        return true;
+    case F_ATTRIBUTES:
+        stack_.push_back(Frame(K_ATTRIBUTE, static_cast<DNF*>(msg)->add_attributes(), F_NONE));
+        return true;
+    case F_CONJUNCTIONS:
+        stack_.push_back(Frame(K_CONJUNCTION, static_cast<Disjunction*>(msg)->add_conjunctions(), F_NONE));
+        return true;
+    case F_VALUE:
+        stack_.push_back(Frame(K_CONJ_VALUE, static_cast<Conjunction*>(msg)->mutable_value(), F_NONE));
+        return true;
+    case F_INT32_INTVL:
+        stack_.push_back(Frame(K_INT32_INTVL, static_cast<ConjValue*>(msg)->add_int32_intvl(), F_NONE));
+        return true;
+    case F_DOUBLE_INTVL:
+        stack_.push_back(Frame(K_DOUBLE_INTVL, static_cast<ConjValue*>(msg)->add_double_intvl(), F_NONE));
+        return true;
+    case F_STRING_INTVL:
+        stack_.push_back(Frame(K_STRING_INTVL, static_cast<ConjValue*>(msg)->add_string_intvl(), F_NONE));
+        return true;
+    case F_GEO:
+        stack_.push_back(Frame(K_GEO, static_cast<ConjValue*>(msg)->mutable_geo(), F_NONE));
+        return true;
+    case F_GEOS:
+        stack_.push_back(Frame(K_GEO, static_cast<ConjValue*>(msg)->add_geos(), F_NONE));
+        return true;
+    case F_GEO_CIRCLE:
+        stack_.push_back(Frame(K_GEO_CIRCLE, static_cast<ConjValue*>(msg)->add_geo_circle(), F_NONE));
+        return true;
+    case F_GEO_POLYGON:
+        stack_.push_back(Frame(K_GEO_POLYGON, static_cast<ConjValue*>(msg)->add_geo_polygon(), F_NONE));
+        return true;
+    case F_POINTS:
+        stack_.push_back(Frame(K_GEO, static_cast<GeoPolygon*>(msg)->add_points(), F_NONE));
+        return true;
+    default:
+        return Fail("unexpected object");
+    }
+}
+
+// an array frame keeps the message and the field of its elements
+bool DNFHandler::StartArray() {
+    Field field = CurrentField();
+    switch (field) {
+    case F_SKIP:
+        stack_.push_back(Frame(K_SKIP, NULL, F_SKIP));
+        return true;
+    case F_DISJUNCTIONS:
+    case F_ATTRIBUTES:
+    case F_CONJUNCTIONS:
+    case F_SVAL:
+    case F_IVAL:
+    case F_DVAL:
+    case F_INT32_INTVL:
+    case F_DOUBLE_INTVL:
+    case F_STRING_INTVL:
+    case F_GEO_CIRCLE:
+    case F_GEO_POLYGON:
+    case F_GEOS:
+    case F_GEO_POINTS:
+    case F_POINTS:
+        if (stack_.back().kind == K_ARRAY) {
+            return Fail("nested array");
+        }
+        stack_.push_back(Frame(K_ARRAY, CurrentMessage(), field));
+        return true;
+    default:
+        return Fail("unexpected array");
+    }
+}
+
+//
+// bounded input stream, the buffer needs no terminating '\0'. The butil
+// reader also takes string bytes by address, which MemoryStream lacks
+//
+struct BufferStream {
+    typedef char Ch;
+    BufferStream(const char *src, size_t length) : src_(src), head_(src), end_(src + length) {}
+    Ch Peek() const { return (src_ == end_) ? '\0' : *src_; }
+    Ch Take() { return (src_ == end_) ? '\0' : *src_++; }
+    const Ch* TakeWithAddr() { return (src_ == end_) ? NULL : src_++; }
+    bool ReadBlockTail() { return false; }
+    size_t Tell() const { return static_cast<size_t>(src_ - head_); }
+
+    Ch* PutBegin() { return NULL; }
+    void Put(Ch) {}
+    void Flush() {}
+    size_t PutEnd(Ch*) { return 0; }
+
+    const Ch *src_;
+    const Ch *head_;
+    const Ch *end_;
+};
+
+} // namespace
+
+struct DNFParserImpl {
+    explicit DNFParserImpl(std::string *err) : handler(err) {}
+    DNFHandler handler;
+    butil::rapidjson::Reader reader;
+};
+
+DNFParser::DNFParser() : impl_(new DNFParserImpl(&error_)) {
+}
+
+DNFParser::~DNFParser() {
+}
+
+bool DNFParser::Parse(const char *json, size_t length, DNF *dnf) {
+    dnf->Clear();
+    error_.clear();
+    impl_->handler.Reset(dnf);
+    BufferStream stream(json, length);
+    butil::rapidjson::ParseResult result = impl_->reader.Parse<0>(stream, impl_->handler);
+    if (result.IsError()) {
+        if (error_.empty()) {
+            error_ = butil::rapidjson::GetParseError_En(result.Code());
+        }
+        error_ += " at offset " + std::to_string(result.Offset());
+        return false;
+    }
+    if (!dnf->IsInitialized()) {
+        error_ = "missing required fields: " + dnf->InitializationErrorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace cloris
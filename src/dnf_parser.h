@@ -0,0 +1,42 @@
+//
+// streaming DNF json parser
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+// DNF json is read by a SAX handler straight into the fields of a DNF
+// message, there is no json DOM and no reflection as in json2pb. A DNF
+// reused across calls keeps its cleared sub-messages and strings, so a bulk
+// load allocates almost nothing per document once warmed up
+//
+
+#ifndef CLORIS_DNF_PARSER_H_
+#define CLORIS_DNF_PARSER_H_
+
+#include <memory>
+#include <string>
+#include "inverted_index.pb.h"
+
+namespace cloris {
+
+struct DNFParserImpl;
+
+// not thread-safe, use one parser per thread
+class DNFParser {
+public:
+    DNFParser();
+    ~DNFParser();
+    // parse one json object into 'dnf', which is cleared first. Unknown keys
+    // are skipped, type mismatches and missing required fields fail
+    bool Parse(const char *json, size_t length, DNF *dnf);
+    bool Parse(const std::string& json, DNF *dnf) { return Parse(json.data(), json.size(), dnf); }
+    const std::string& error() const { return error_; }
+private:
+    DNFParser(const DNFParser&) = delete;
+    DNFParser& operator=(const DNFParser&) = delete;
+    std::unique_ptr<DNFParserImpl> impl_;
+    std::string error_;
+};
+
+} // namespace cloris
+
+#endif // CLORIS_DNF_PARSER_H_
@@ -4,7 +4,6 @@
 
 #include <fstream>
 #include <iostream>
-#include "jsoncpp/json_util.h"
 #include "clorisearch.h"
 
 using namespace cloris;
@@ -4,7 +4,6 @@
 
 #include <fstream>
 #include <iostream>
-#include "jsoncpp/json_util.h"
 #include "clorisearch.h"
 
 using namespace cloris;
@@ -63,6 +62,18 @@ int main() {
     std::vector<int> res = sch->Search(query, 10);
     std::cout << "search result, size=" << res.size() << std::endl;
 
+    for (auto &p : res) {
+        std::cout << "docid=" << p << std::endl;
+    }
+
+    // range search, age ∈ [24, 28]
+    Query range_query;
+    range_query["city"] = "shanghai";
+    range_query.Append(Term("age", 24, 28, 3));
+
+    res = sch->Search(range_query, 10);
+    std::cout << "range search result, size=" << res.size() << std::endl;
+
     for (auto &p : res) {
         std::cout << "docid=" << p << std::endl;
     }
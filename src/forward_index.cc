@@ -1,15 +1,486 @@
 //
-// inverted index main class definition
-// version: 1.0 
+// forward index main class implementation
+// version: 1.0
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <limits>
+#include "internal/log.h"
 #include "forward_index.h"
 
+// "CLFWD" and the format version
+#define FORWARD_MAGIC       0x0001445746574C43ULL
+#define FORWARD_ALIGN       8
+// docids read ahead of the gather
+#define FORWARD_PREFETCH    8
+
 namespace cloris {
 
-bool ForwardIndex::Init() {
+// file layout, every part padded to 8 bytes:
+//   magic, column count
+//   per column: FileColumnHeader, name, then its arrays in the order of
+//   ForwardColumn, only the ones of its type
+struct FileColumnHeader {
+    uint32_t type;
+    uint32_t name_length;
+    uint64_t rows;
+    uint64_t dict_offsets;
+    uint64_t dict_bytes;
+};
+
+static inline size_t Padded(size_t n) {
+    return (n + FORWARD_ALIGN - 1) / FORWARD_ALIGN * FORWARD_ALIGN;
+}
+
+static bool ParseValueType(const std::string& name, ForwardValueType *type) {
+    if (name == "int64") {
+        *type = FVT_INT64;
+    } else if (name == "double") {
+        *type = FVT_DOUBLE;
+    } else if (name == "string") {
+        *type = FVT_STRING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// an empty column, a string one has code 0 for ""
+static void ResetColumn(ForwardColumn& column) {
+    column.ints.Map(NULL, 0);
+    column.doubles.Map(NULL, 0);
+    column.codes.Map(NULL, 0);
+    column.dict_offsets.Map(NULL, 0);
+    column.dict_bytes.Map(NULL, 0);
+    column.dict_index.clear();
+    if (column.type == FVT_STRING) {
+        uint32_t empty[2] = { 0, 0 };
+        column.dict_offsets.Append(empty, 2);
+    }
+}
+
+static uint32_t Intern(ForwardColumn& column, const std::string& value) {
+    if (value.empty()) {
+        return 0;
+    }
+    size_t dict_size = column.dict_offsets.size() - 1;
+    if (column.dict_index.size() + 1 < dict_size) {
+        // loaded from a file
+        for (size_t code = 1; code < dict_size; ++code) {
+            uint32_t begin = column.dict_offsets[code];
+            std::string s(column.dict_bytes.data() + begin, column.dict_offsets[code + 1] - begin);
+            column.dict_index[s] = static_cast<uint32_t>(code);
+        }
+    }
+    auto it = column.dict_index.find(value);
+    if (it != column.dict_index.end()) {
+        return it->second;
+    }
+    if (column.dict_bytes.size() + value.size() > std::numeric_limits<uint32_t>::max()) {
+        return std::numeric_limits<uint32_t>::max();
+    }
+    uint32_t code = static_cast<uint32_t>(dict_size);
+    column.dict_bytes.Append(value.data(), value.size());
+    uint32_t end = static_cast<uint32_t>(column.dict_bytes.size());
+    column.dict_offsets.Append(&end, 1);
+    column.dict_index[value] = code;
+    return code;
+}
+
+// docids out of the column, e.g. docs added before the field had values,
+// read as the default value
+template <typename T>
+static void Gather(const ColumnArray<T>& column, const std::vector<int>& docids, T *out) {
+    const T *base = column.data();
+    size_t rows = column.size();
+    size_t n = docids.size();
+    for (size_t i = 0; i < n; ++i) {
+        if (i + FORWARD_PREFETCH < n) {
+            size_t ahead = static_cast<size_t>(docids[i + FORWARD_PREFETCH]);
+            if (ahead < rows) {
+                __builtin_prefetch(base + ahead);
+            }
+        }
+        size_t docid = static_cast<size_t>(docids[i]);
+        out[i] = (docid < rows) ? base[docid] : T();
+    }
+}
+
+ForwardIndex::ForwardIndex() : mapped_(NULL), mapped_size_(0) {
+}
+
+ForwardIndex::~ForwardIndex() {
+    this->Unmap();
+}
+
+bool ForwardIndex::Init(const IndexSchema& schema, std::string& err_msg) {
+    // sized once, the columns are never moved afterwards
+    columns_.resize(schema.fields_size());
+    for (int i = 0; i < schema.fields_size(); ++i) {
+        const IndexSchema::Field& field = schema.fields(i);
+        ForwardColumn& column = columns_[i];
+        if (!ParseValueType(field.value_type(), &column.type)) {
+            err_msg = "unknown value_type " + field.value_type() + " of forward field " + field.name();
+            return false;
+        }
+        if (!column_index_.insert(std::make_pair(field.name(), i)).second) {
+            err_msg = "duplicate forward field " + field.name();
+            return false;
+        }
+        column.name = field.name();
+        ResetColumn(column);
+    }
+    return true;
+}
+
+bool ForwardIndex::Add(const DNF& dnf) {
+    if (dnf.attributes_size() == 0) {
+        return true;
+    }
+    int docid = dnf.docid();
+    if (docid < 0 || docid >= FORWARD_MAX_DOCID) {
+        cLog(ERROR, "forward index add failed: docid=%d out of range", docid);
+        return false;
+    }
+    bool ok = true;
+    for (auto& attr : dnf.attributes()) {
+        auto it = column_index_.find(attr.name());
+        if (it == column_index_.end()) {
+            cLog(WARN, "forward index: undeclared field %s, docid=%d", attr.name().c_str(), docid);
+            ok = false;
+            continue;
+        }
+        ForwardColumn& column = columns_[it->second];
+        bool typed = true;
+        switch (column.type) {
+        case FVT_INT64:
+            typed = attr.has_ival();
+            if (typed) {
+                column.ints.Set(docid, attr.ival());
+            }
+            break;
+        case FVT_DOUBLE:
+            typed = attr.has_dval() || attr.has_ival();
+            if (typed) {
+                column.doubles.Set(docid, attr.has_dval() ? attr.dval() : static_cast<double>(attr.ival()));
+            }
+            break;
+        case FVT_STRING:
+            typed = attr.has_sval();
+            if (typed) {
+                uint32_t code = Intern(column, attr.sval());
+                if (code == std::numeric_limits<uint32_t>::max()) {
+                    cLog(ERROR, "forward index: dictionary of %s is full, docid=%d", attr.name().c_str(), docid);
+                    ok = false;
+                    continue;
+                }
+                column.codes.Set(docid, code);
+            }
+            break;
+        }
+        if (!typed) {
+            cLog(WARN, "forward index: no value of the type of %s, docid=%d", attr.name().c_str(), docid);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+const ForwardColumn* ForwardIndex::Column(const std::string& name, ForwardValueType type) const {
+    auto it = column_index_.find(name);
+    if (it == column_index_.end() || columns_[it->second].type != type) {
+        return NULL;
+    }
+    return &columns_[it->second];
+}
+
+bool ForwardIndex::Fetch(const std::vector<int>& docids, const std::string& name, std::vector<int64_t>& values) const {
+    const ForwardColumn *column = this->Column(name, FVT_INT64);
+    if (!column) {
+        return false;
+    }
+    values.resize(docids.size());
+    Gather(column->ints, docids, values.data());
     return true;
 }
 
+bool ForwardIndex::Fetch(const std::vector<int>& docids, const std::string& name, std::vector<double>& values) const {
+    const ForwardColumn *column = this->Column(name, FVT_DOUBLE);
+    if (!column) {
+        return false;
+    }
+    values.resize(docids.size());
+    Gather(column->doubles, docids, values.data());
+    return true;
+}
+
+bool ForwardIndex::FetchCodes(const std::vector<int>& docids, const std::string& name, std::vector<uint32_t>& codes) const {
+    const ForwardColumn *column = this->Column(name, FVT_STRING);
+    if (!column) {
+        return false;
+    }
+    codes.resize(docids.size());
+    Gather(column->codes, docids, codes.data());
+    return true;
+}
+
+bool ForwardIndex::Fetch(const std::vector<int>& docids, const std::string& name, std::vector<std::string>& values) const {
+    const ForwardColumn *column = this->Column(name, FVT_STRING);
+    if (!column) {
+        return false;
+    }
+    std::vector<uint32_t> codes(docids.size());
+    Gather(column->codes, docids, codes.data());
+    values.resize(docids.size());
+    for (size_t i = 0; i < codes.size(); ++i) {
+        uint32_t begin = column->dict_offsets[codes[i]];
+        values[i].assign(column->dict_bytes.data() + begin, column->dict_offsets[codes[i] + 1] - begin);
+    }
+    return true;
+}
+
+// the column is looked up by each call, a write may have moved its array
+bool ForwardIndex::GetScoreFunction(const std::string& name, ScoreFunction& score) const {
+    const ForwardColumn *column = this->Column(name, FVT_DOUBLE);
+    if (column) {
+        score = [column](int docid) {
+            size_t row = static_cast<size_t>(docid);
+            return (row < column->doubles.size()) ? column->doubles[row] : 0.0;
+        };
+        return true;
+    }
+    column = this->Column(name, FVT_INT64);
+    if (column) {
+        score = [column](int docid) {
+            size_t row = static_cast<size_t>(docid);
+            return (row < column->ints.size()) ? static_cast<double>(column->ints[row]) : 0.0;
+        };
+        return true;
+    }
+    return false;
+}
+
+bool ForwardIndex::Decode(const std::string& name, uint32_t code, std::string& value) const {
+    const ForwardColumn *column = this->Column(name, FVT_STRING);
+    if (!column || static_cast<size_t>(code) + 1 >= column->dict_offsets.size()) {
+        return false;
+    }
+    uint32_t begin = column->dict_offsets[code];
+    value.assign(column->dict_bytes.data() + begin, column->dict_offsets[code + 1] - begin);
+    return true;
+}
+
+static bool WritePadded(FILE *fp, const void *data, size_t length) {
+    static const char zeros[FORWARD_ALIGN] = { 0 };
+    size_t pad = Padded(length) - length;
+    return (length == 0 || fwrite(data, 1, length, fp) == length) && (pad == 0 || fwrite(zeros, 1, pad, fp) == pad);
+}
+
+bool ForwardIndex::Save(const std::string& path) const {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        cLog(ERROR, "forward index save failed: can't open %s, errno=%d", path.c_str(), errno);
+        return false;
+    }
+    uint64_t head[2] = { FORWARD_MAGIC, columns_.size() };
+    bool ok = WritePadded(fp, head, sizeof(head));
+    for (auto& column : columns_) {
+        FileColumnHeader header;
+        memset(&header, 0, sizeof(header));
+        header.type = column.type;
+        header.name_length = static_cast<uint32_t>(column.name.size());
+        header.rows = (column.type == FVT_INT64) ? column.ints.size()
+                    : (column.type == FVT_DOUBLE) ? column.doubles.size() : column.codes.size();
+        header.dict_offsets = column.dict_offsets.size();
+        header.dict_bytes = column.dict_bytes.size();
+        ok = ok && WritePadded(fp, &header, sizeof(header)) && WritePadded(fp, column.name.data(), column.name.size());
+        switch (column.type) {
+        case FVT_INT64:
+            ok = ok && WritePadded(fp, column.ints.data(), column.ints.bytes());
+            break;
+        case FVT_DOUBLE:
+            ok = ok && WritePadded(fp, column.doubles.data(), column.doubles.bytes());
+            break;
+        case FVT_STRING:
+            ok = ok && WritePadded(fp, column.codes.data(), column.codes.bytes())
+                    && WritePadded(fp, column.dict_offsets.data(), column.dict_offsets.bytes())
+                    && WritePadded(fp, column.dict_bytes.data(), column.dict_bytes.bytes());
+            break;
+        }
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        cLog(ERROR, "forward index save failed: write %s, errno=%d", path.c_str(), errno);
+    }
+    return ok;
+}
+
+// bounds checked reads of the mapped file
+class MappedReader {
+public:
+    MappedReader(const char *data, size_t size) : data_(data), size_(size), pos_(0) {}
+    const char* Read(size_t length) {
+        if (length > size_ - pos_ || Padded(length) > size_ - pos_) {
+            return NULL;
+        }
+        const char *p = data_ + pos_;
+        pos_ += Padded(length);
+        return p;
+    }
+private:
+    const char *data_;
+    size_t size_;
+    size_t pos_;
+};
+
+struct MappedColumn {
+    size_t index;
+    FileColumnHeader header;
+    const char *data;
+    const char *dict_offsets;
+    const char *dict_bytes;
+};
+
+bool ForwardIndex::Load(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cLog(ERROR, "forward index load failed: can't open %s, errno=%d", path.c_str(), errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        cLog(ERROR, "forward index load failed: empty %s", path.c_str());
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        cLog(ERROR, "forward index load failed: can't mmap %s, errno=%d", path.c_str(), errno);
+        return false;
+    }
+
+    // check the whole file before any column points into it
+    MappedReader reader(static_cast<const char*>(mapped), size);
+    std::vector<MappedColumn> loaded;
+    const char *error = NULL;
+    const uint64_t *head = reinterpret_cast<const uint64_t*>(reader.Read(2 * sizeof(uint64_t)));
+    if (!head || head[0] != FORWARD_MAGIC) {
+        error = "bad magic";
+    }
+    for (uint64_t i = 0; !error && i < head[1]; ++i) {
+        MappedColumn m;
+        const char *p = reader.Read(sizeof(FileColumnHeader));
+        if (!p) {
+            error = "truncated";
+            break;
+        }
+        memcpy(&m.header, p, sizeof(m.header));
+        const char *name = reader.Read(m.header.name_length);
+        if (!name) {
+            error = "truncated";
+            break;
+        }
+        auto it = column_index_.find(std::string(name, m.header.name_length));
+        if (it == column_index_.end() || columns_[it->second].type != m.header.type) {
+            error = "field not declared with this type";
+            break;
+        }
+        m.index = it->second;
+        if (m.header.rows > FORWARD_MAX_DOCID || m.header.dict_offsets > std::numeric_limits<uint32_t>::max()) {
+            error = "bad column size";
+            break;
+        }
+        size_t width = (m.header.type == FVT_STRING) ? sizeof(uint32_t) : sizeof(uint64_t);
+        m.data = reader.Read(m.header.rows * width);
+        m.dict_offsets = reader.Read(m.header.dict_offsets * sizeof(uint32_t));
+        m.dict_bytes = reader.Read(m.header.dict_bytes);
+        if (!m.data || !m.dict_offsets || !m.dict_bytes) {
+            error = "truncated";
+            break;
+        }
+        if (m.header.type == FVT_STRING) {
+            // every code and offset must stay inside the dictionary
+            const uint32_t *offsets = reinterpret_cast<const uint32_t*>(m.dict_offsets);
+            const uint32_t *codes = reinterpret_cast<const uint32_t*>(m.data);
+            bool valid = m.header.dict_offsets >= 2 && offsets[0] == 0;
+            for (uint64_t k = 1; valid && k < m.header.dict_offsets; ++k) {
+                valid = offsets[k] >= offsets[k - 1] && offsets[k] <= m.header.dict_bytes;
+            }
+            for (uint64_t k = 0; valid && k < m.header.rows; ++k) {
+                valid = static_cast<uint64_t>(codes[k]) + 1 < m.header.dict_offsets;
+            }
+            if (!valid) {
+                error = "bad dictionary";
+                break;
+            }
+        }
+        loaded.push_back(m);
+    }
+    if (error) {
+        munmap(mapped, size);
+        cLog(ERROR, "forward index load failed: %s, %s", error, path.c_str());
+        return false;
+    }
+
+    for (auto& column : columns_) {
+        ResetColumn(column);
+    }
+    for (auto& m : loaded) {
+        ForwardColumn& column = columns_[m.index];
+        switch (column.type) {
+        case FVT_INT64:
+            column.ints.Map(reinterpret_cast<const int64_t*>(m.data), m.header.rows);
+            break;
+        case FVT_DOUBLE:
+            column.doubles.Map(reinterpret_cast<const double*>(m.data), m.header.rows);
+            break;
+        case FVT_STRING:
+            column.codes.Map(reinterpret_cast<const uint32_t*>(m.data), m.header.rows);
+            column.dict_offsets.Map(reinterpret_cast<const uint32_t*>(m.dict_offsets), m.header.dict_offsets);
+            column.dict_bytes.Map(m.dict_bytes, m.header.dict_bytes);
+            break;
+        }
+    }
+    this->Unmap();
+    mapped_ = mapped;
+    mapped_size_ = size;
+    cLog(INFO, "forward index loaded from %s, %zu fields, %zu docs", path.c_str(), loaded.size(), this->docs());
+    return true;
+}
+
+void ForwardIndex::Unmap() {
+    if (mapped_) {
+        munmap(mapped_, mapped_size_);
+        mapped_ = NULL;
+        mapped_size_ = 0;
+    }
+}
+
+size_t ForwardIndex::docs() const {
+    size_t rows = 0;
+    for (auto& column : columns_) {
+        rows = std::max(rows, std::max(column.ints.size(), std::max(column.doubles.size(), column.codes.size())));
+    }
+    return rows;
+}
+
+size_t ForwardIndex::bytes() const {
+    size_t bytes = 0;
+    for (auto& column : columns_) {
+        bytes += column.ints.bytes() + column.doubles.bytes() + column.codes.bytes()
+               + column.dict_offsets.bytes() + column.dict_bytes.bytes();
+    }
+    return bytes;
+}
+
 } // namespace cloris
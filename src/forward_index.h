@@ -1,27 +1,140 @@
 //
-// inverted index main class definition
-// InvertedIndex is the manager class of inverted index
-// version: 1.0 
+// forward index main class definition
+// ForwardIndex keeps the payload of every doc by docid, columnar: numbers in
+// dense arrays indexed by docid, strings as codes into a per field dictionary.
+// A saved index is loaded back by mmap, the columns then point into the file
+// version: 1.0
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
 #ifndef CLORIS_FORWARD_INDEX_H_
 #define CLORIS_FORWARD_INDEX_H_
 
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "index_schema.pb.h"
+#include "inverted_index.pb.h"
+#include "internal/top_k.h"
+
+// columns are sized by the largest docid, larger docids are rejected
+#define FORWARD_MAX_DOCID   (1 << 28)
+
 namespace cloris {
 
+enum ForwardValueType {
+    FVT_INT64  = 0,
+    FVT_DOUBLE = 1,
+    FVT_STRING = 2,
+};
+
+//
+// array of a column, owned while the index is built or a view into the
+// mapped file once loaded. A loaded array is copied on the first write
+//
+template <typename T>
+class ColumnArray {
+public:
+    ColumnArray() : base_(NULL), size_(0) {}
+    inline const T* data() const { return base_; }
+    inline size_t size() const { return size_; }
+    inline T operator[](size_t i) const { return base_[i]; }
+    inline bool mapped() const { return base_ != NULL && base_ != vec_.data(); }
+    void Set(size_t i, T value) {
+        if (mapped()) {
+            vec_.assign(base_, base_ + size_);
+        }
+        if (i >= vec_.size()) {
+            vec_.resize(i + 1, T());
+        }
+        vec_[i] = value;
+        this->Sync();
+    }
+    void Append(const T *values, size_t n) {
+        if (mapped()) {
+            vec_.assign(base_, base_ + size_);
+        }
+        vec_.insert(vec_.end(), values, values + n);
+        this->Sync();
+    }
+    void Map(const T *base, size_t size) {
+        std::vector<T>().swap(vec_);
+        base_ = base;
+        size_ = size;
+    }
+    size_t bytes() const { return size_ * sizeof(T); }
+private:
+    void Sync() {
+        base_ = vec_.data();
+        size_ = vec_.size();
+    }
+    std::vector<T> vec_;
+    const T *base_;
+    size_t size_;
+};
+
+struct ForwardColumn {
+    std::string name;
+    ForwardValueType type;
+    ColumnArray<int64_t> ints;
+    ColumnArray<double> doubles;
+    // string columns: codes by docid, and the dictionary as the offsets of
+    // every string in 'dict_bytes'. Code 0 is the empty string
+    ColumnArray<uint32_t> codes;
+    ColumnArray<uint32_t> dict_offsets;
+    ColumnArray<char> dict_bytes;
+    std::unordered_map<std::string, uint32_t> dict_index; // built lazily after a load
+};
+
 class ForwardIndex {
 public:
-    ForwardIndex() { }
-    ~ForwardIndex() { }
+    ForwardIndex();
+    ~ForwardIndex();
 
-    bool Init();
+    bool Init(const IndexSchema& schema, std::string& err_msg);
+    // store the attributes of 'dnf', the ones of undeclared fields or of the
+    // wrong type are skipped and make it return false
+    bool Add(const DNF& dnf);
 
+    // batched fetch of field 'name' for the matched 'docids', 'values' is
+    // resized to match. Docs without a value get 0, 0.0 or "". False if the
+    // field is unknown or of another type
+    bool Fetch(const std::vector<int>& docids, const std::string& name, std::vector<int64_t>& values) const;
+    bool Fetch(const std::vector<int>& docids, const std::string& name, std::vector<double>& values) const;
+    bool Fetch(const std::vector<int>& docids, const std::string& name, std::vector<std::string>& values) const;
+    // dictionary codes of a string field, equal strings have equal codes, so
+    // filtering and grouping, e.g. by frequency cap key, need no string compare
+    bool FetchCodes(const std::vector<int>& docids, const std::string& name, std::vector<uint32_t>& codes) const;
+    // reads int64 or double field 'name' of one doc as a top-k score, docs
+    // without a value score 0. Valid while the index lives
+    bool GetScoreFunction(const std::string& name, ScoreFunction& score) const;
+    // the string of 'code' in field 'name'
+    bool Decode(const std::string& name, uint32_t code, std::string& value) const;
+
+    // write all columns to 'path', Load maps it back. The fields of the file
+    // must be declared with the same types, declared fields missing from it
+    // stay empty
+    bool Save(const std::string& path) const;
+    bool Load(const std::string& path);
+
+    // true once a Load succeeded
+    bool loaded() const { return mapped_ != NULL; }
+    // rows of the largest column, i.e. the largest docid + 1
+    size_t docs() const;
+    size_t bytes() const;
 private:
-    int pos_;
-    // *p...
+    ForwardIndex(const ForwardIndex&) = delete;
+    ForwardIndex& operator=(const ForwardIndex&) = delete;
+    const ForwardColumn* Column(const std::string& name, ForwardValueType type) const;
+    void Unmap();
+
+    std::vector<ForwardColumn> columns_;
+    std::unordered_map<std::string, size_t> column_index_;
+    void *mapped_;
+    size_t mapped_size_;
 };
 
 } // namespace cloris
 
-#endif // CLORIS_FORWARD_INDEX_H_ 
+#endif // CLORIS_FORWARD_INDEX_H_
@@ -0,0 +1,309 @@
+//
+// compiled interval index definition
+// An immutable snapshot of IntervalIndexer for read-mostly data: segment
+// boundaries live in contiguous arrays and are searched by branchless binary
+// search, segments with identical doc lists share one posting block
+// version: 1.0 
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_COMPILED_INTERVAL_H_
+#define CLORIS_COMPILED_INTERVAL_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "internal/metrics.h"
+#include "posting_list.h"
+#include "interval.h"
+
+// int32 domains up to this size may use a dense lookup table
+#define DENSE_DOMAIN_MAX_SIZE   65536
+
+namespace cloris {
+
+// doc lists shared by the segments of a snapshot
+class PostingBlocks {
+public:
+    PostingBlocks() {}
+    ~PostingBlocks() {}
+    // id of the block equal to 'ilist', a new block is added if none is found
+    uint32_t Intern(const InvertedList& ilist) {
+        size_t hash = ilist.Hash();
+        auto range = table_.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (blocks_[iter->second] == ilist.doc_list()) {
+                return iter->second;
+            }
+        }
+        uint32_t block_id = static_cast<uint32_t>(blocks_.size());
+        blocks_.push_back(ilist.doc_list());
+        table_.insert(std::make_pair(hash, block_id));
+        return block_id;
+    }
+    // drop the hash table once all blocks are interned
+    void Seal() { std::unordered_multimap<size_t, uint32_t>().swap(table_); }
+    void Clear() {
+        std::vector<std::list<DocidNode>>().swap(blocks_);
+        std::unordered_multimap<size_t, uint32_t>().swap(table_);
+    }
+    std::list<DocidNode>* block(uint32_t block_id) { return &blocks_[block_id]; }
+    size_t size() const { return blocks_.size(); }
+    size_t bytes() const {
+        size_t n = blocks_.capacity() * sizeof(std::list<DocidNode>);
+        for (auto& block : blocks_) {
+            n += block.size() * POSTING_NODE_BYTES;
+        }
+        return n;
+    }
+private:
+    std::vector<std::list<DocidNode>> blocks_;
+    std::unordered_multimap<size_t, uint32_t> table_; // hash ==> block id
+};
+
+template <typename T>
+class CompiledIntervals {
+    typedef BoundaryPoint<T> Point;
+public:
+    CompiledIntervals() {}
+    ~CompiledIntervals() {}
+
+    void Clear();
+    // segments must be appended in ascending order
+    void Append(const Point& left, const Point& right, const InvertedList& ilist);
+    void Seal() { blocks_.Seal(); }
+    void GetPostingLists(const Point& left, const Point& right, DocListGroup& group);
+    std::list<DocidNode>* GetPostingList(const Point& point);
+    size_t segment_size() const { return lefts_.size(); }
+    size_t block_size() const { return blocks_.size(); }
+    size_t bytes() const {
+        return (lefts_.capacity() + rights_.capacity()) * sizeof(Point)
+               + block_ids_.capacity() * sizeof(uint32_t) + blocks_.bytes();
+    }
+private:
+    // index of the last segment whose left point <= 'point', or -1
+    int64_t UpperSegment(const Point& point) const;
+    // index of the first segment whose right point >= 'point'
+    size_t LowerSegment(const Point& point) const;
+
+    std::vector<Point> lefts_;
+    std::vector<Point> rights_;
+    std::vector<uint32_t> block_ids_;
+    PostingBlocks blocks_;
+};
+
+template <typename T>
+void CompiledIntervals<T>::Clear() {
+    std::vector<Point>().swap(lefts_);
+    std::vector<Point>().swap(rights_);
+    std::vector<uint32_t>().swap(block_ids_);
+    blocks_.Clear();
+}
+
+template <typename T>
+void CompiledIntervals<T>::Append(const Point& left, const Point& right, const InvertedList& ilist) {
+    lefts_.push_back(left);
+    rights_.push_back(right);
+    block_ids_.push_back(blocks_.Intern(ilist));
+}
+
+//
+// the loop body compiles to a conditional move, so there is no branch to
+// mispredict and the number of iterations only depends on the segment size
+//
+template <typename T>
+int64_t CompiledIntervals<T>::UpperSegment(const Point& point) const {
+    size_t n = lefts_.size();
+    if (n == 0 || point < lefts_[0]) {
+        return -1;
+    }
+    const Point *base = &lefts_[0];
+    while (n > 1) {
+        size_t half = n >> 1;
+        base = (base[half] <= point) ? base + half : base;
+        n -= half;
+    }
+    return base - &lefts_[0];
+}
+
+template <typename T>
+size_t CompiledIntervals<T>::LowerSegment(const Point& point) const {
+    size_t n = rights_.size();
+    if (n == 0) {
+        return 0;
+    }
+    const Point *base = &rights_[0];
+    while (n > 1) {
+        size_t half = n >> 1;
+        base = (base[half] < point) ? base + half : base;
+        n -= half;
+    }
+    return (base - &rights_[0]) + ((*base < point) ? 1 : 0);
+}
+
+template <typename T>
+std::list<DocidNode>* CompiledIntervals<T>::GetPostingList(const Point& point) {
+    int64_t pos = UpperSegment(point);
+    if (pos < 0 || rights_[pos] < point) {
+        return NULL;
+    }
+    return blocks_.block(block_ids_[pos]);
+}
+
+template <typename T>
+void CompiledIntervals<T>::GetPostingLists(const Point& left, const Point& right, DocListGroup& group) {
+    uint32_t last_block = static_cast<uint32_t>(-1);
+    for (size_t pos = LowerSegment(left); pos < lefts_.size() && !(right < lefts_[pos]); ++pos) {
+        // adjacent segments may share one block
+        if (block_ids_[pos] != last_block) {
+            last_block = block_ids_[pos];
+            group.push_back(blocks_.block(last_block));
+        }
+    }
+}
+
+//
+// int32 fast path (age, hour of day, timestamp...). Boundaries are mapped onto
+// a doubled line, value v is 2v and the open gap right after it is 2v + 1, so
+// (10, 20] becomes [21, 40] and both ends can be compared without flags while
+// overlap stays exactly as in the skip list. If a small value domain is
+// declared in the schema, a dense table maps every value to its segment
+// directly, values out of the domain still go through the binary search
+//
+template <>
+class CompiledIntervals<int32_t> {
+    typedef BoundaryPoint<int32_t> Point;
+public:
+    CompiledIntervals() : domain_min_(0), domain_max_(-1) {}
+    ~CompiledIntervals() {}
+
+    bool SetDomain(int32_t min_value, int32_t max_value);
+    bool has_domain() const { return domain_min_ <= domain_max_; }
+    void Clear();
+    void Append(const Point& left, const Point& right, const InvertedList& ilist);
+    void Seal();
+    void GetPostingLists(const Point& left, const Point& right, DocListGroup& group);
+    std::list<DocidNode>* GetPostingList(const Point& point) {
+        int64_t pos = Find(point.value);
+        return (pos < 0) ? NULL : blocks_.block(block_ids_[pos]);
+    }
+    size_t segment_size() const { return lefts_.size(); }
+    size_t block_size() const { return blocks_.size(); }
+    size_t bytes() const {
+        return (lefts_.capacity() + rights_.capacity()) * sizeof(int64_t) + block_ids_.capacity() * sizeof(uint32_t)
+               + dense_.capacity() * sizeof(int32_t) + blocks_.bytes();
+    }
+private:
+    static int64_t DoubledLeft(const Point& p) {
+        return static_cast<int64_t>(p.value) * 2 + ((p.flag & INTERVAL_CLOSE_MASK) ? 0 : 1);
+    }
+    static int64_t DoubledRight(const Point& p) {
+        return static_cast<int64_t>(p.value) * 2 - ((p.flag & INTERVAL_CLOSE_MASK) ? 0 : 1);
+    }
+    // segment holding 'value', or -1
+    int64_t Find(int32_t value) const;
+    // index of the first segment whose right end >= 'point' on the doubled line
+    size_t LowerSegment(int64_t point) const;
+
+    std::vector<int64_t> lefts_;
+    std::vector<int64_t> rights_;
+    std::vector<uint32_t> block_ids_;
+    std::vector<int32_t> dense_; // value - domain_min_ ==> segment, -1 if none
+    int32_t domain_min_;
+    int32_t domain_max_;
+    PostingBlocks blocks_;
+};
+
+inline bool CompiledIntervals<int32_t>::SetDomain(int32_t min_value, int32_t max_value) {
+    if (max_value < min_value ||
+            static_cast<int64_t>(max_value) - min_value >= DENSE_DOMAIN_MAX_SIZE) {
+        return false;
+    }
+    domain_min_ = min_value;
+    domain_max_ = max_value;
+    return true;
+}
+
+// the declared domain survives Clear
+inline void CompiledIntervals<int32_t>::Clear() {
+    std::vector<int64_t>().swap(lefts_);
+    std::vector<int64_t>().swap(rights_);
+    std::vector<uint32_t>().swap(block_ids_);
+    std::vector<int32_t>().swap(dense_);
+    blocks_.Clear();
+}
+
+inline void CompiledIntervals<int32_t>::Append(const Point& left, const Point& right, const InvertedList& ilist) {
+    lefts_.push_back(DoubledLeft(left));
+    rights_.push_back(DoubledRight(right));
+    block_ids_.push_back(blocks_.Intern(ilist));
+}
+
+inline void CompiledIntervals<int32_t>::Seal() {
+    blocks_.Seal();
+    if (!has_domain()) {
+        return;
+    }
+    dense_.assign(static_cast<size_t>(static_cast<int64_t>(domain_max_) - domain_min_ + 1), -1);
+    for (size_t pos = 0; pos < lefts_.size(); ++pos) {
+        // values only sit on even points of the doubled line
+        int64_t lo = std::max<int64_t>((lefts_[pos] + 1) >> 1, domain_min_);
+        int64_t hi = std::min<int64_t>(rights_[pos] >> 1, domain_max_);
+        for (int64_t v = lo; v <= hi; ++v) {
+            dense_[v - domain_min_] = static_cast<int32_t>(pos);
+        }
+    }
+}
+
+inline int64_t CompiledIntervals<int32_t>::Find(int32_t value) const {
+    if (!dense_.empty() && value >= domain_min_ && value <= domain_max_) {
+        return dense_[static_cast<int64_t>(value) - domain_min_];
+    }
+    int64_t point = static_cast<int64_t>(value) * 2;
+    size_t n = lefts_.size();
+    if (n == 0 || point < lefts_[0]) {
+        return -1;
+    }
+    const int64_t *base = &lefts_[0];
+    while (n > 1) {
+        size_t half = n >> 1;
+        base = (base[half] <= point) ? base + half : base;
+        n -= half;
+    }
+    int64_t pos = base - &lefts_[0];
+    return (point <= rights_[pos]) ? pos : -1;
+}
+
+inline size_t CompiledIntervals<int32_t>::LowerSegment(int64_t point) const {
+    size_t n = rights_.size();
+    if (n == 0) {
+        return 0;
+    }
+    const int64_t *base = &rights_[0];
+    while (n > 1) {
+        size_t half = n >> 1;
+        base = (base[half] < point) ? base + half : base;
+        n -= half;
+    }
+    return (base - &rights_[0]) + ((*base < point) ? 1 : 0);
+}
+
+inline void CompiledIntervals<int32_t>::GetPostingLists(const Point& left, const Point& right, DocListGroup& group) {
+    int64_t lo = DoubledLeft(left);
+    int64_t hi = DoubledRight(right);
+    if (lo > hi) {
+        return;
+    }
+    uint32_t last_block = static_cast<uint32_t>(-1);
+    for (size_t pos = LowerSegment(lo); pos < lefts_.size() && lefts_[pos] <= hi; ++pos) {
+        if (block_ids_[pos] != last_block) {
+            last_block = block_ids_[pos];
+            group.push_back(blocks_.block(last_block));
+        }
+    }
+}
+
+} // namespace cloris
+
+#endif // CLORIS_COMPILED_INTERVAL_H_
@@ -5,6 +5,7 @@
 //
 
 #include <algorithm>
+#include <functional>
 #include "posting_list.h"
 #include "conjunction_scorer.h"
 
@@ -21,19 +22,29 @@ void ConjunctionScorer::AddPostingList(std::list<DocidNode>* doc_list, const Rec
     plists_.push_back(pl);
 }
 
-std::vector<int> ConjunctionScorer::GetMatchedDocid(size_t k) {
-    std::vector<int> ret;
+// lists of a group are owned by the indexer, so there is nothing to reclaim
+void ConjunctionScorer::AddPostingList(const DocListGroup& group) {
+    plists_.push_back(PostingList(group));
+}
+
+template <typename Sink>
+void ConjunctionScorer::Match(size_t k, Sink& sink, QueryTrace *trace) {
     if (k == 0) {
         k = 1;
     }
     if (plists_.size() < k) {
-        return ret;
+        return;
     }
     int next_id;
+    size_t scanned = 0;
+    size_t skipped = 0;
+    // sort before the check, a skip may exhaust the list sitting at k - 1
+    // while others are still going
+    std::sort(plists_.begin(), plists_.end());
     while (plists_[k - 1].CurrentEntry() != PostingList::EOL) {
-        std::sort(plists_.begin(), plists_.end());
-        if (plists_[0].CurrentEntry() == plists_[k - 1].CurrentEntry()) {
-            // TODO support NOT IN
+        ++scanned;
+        // compare docids only, a ∉ entry sorts before the ∈ entries of its doc
+        if (plists_[0].CurrentEntry().docid == plists_[k - 1].CurrentEntry().docid) {
             next_id = plists_[k - 1].CurrentEntry().docid + 1;
             //
             // e.g. city NOT IN {'beijing', 'shanghai'}
@@ -41,12 +52,12 @@ std::vector<int> ConjunctionScorer::GetMatchedDocid(size_t k) {
             if (!plists_[0].CurrentEntry().is_belong_to) {
                 // Do nothing, just skip to next_id in [K, plists_.size())
             } else {
-                ret.push_back(plists_[k - 1].CurrentEntry().docid);
+                sink(plists_[k - 1].CurrentEntry().docid);
             }
             // skip same docid, e.g. docid=2,2,2,2,2
             for (size_t L = k; L < plists_.size(); ++L) {
                 if (plists_[L].CurrentEntry().docid < next_id) {
-                    plists_[L].SkipTo(next_id);
+                    skipped += plists_[L].SkipTo(next_id);
                 } else {
                     break;
                 }
@@ -55,10 +66,139 @@ std::vector<int> ConjunctionScorer::GetMatchedDocid(size_t k) {
             next_id = plists_[k - 1].CurrentEntry().docid;
         }
         for (size_t L = 0; L < k; ++L) {
-            plists_[L].SkipTo(next_id);
+            skipped += plists_[L].SkipTo(next_id);
         }
+        std::sort(plists_.begin(), plists_.end());
     } 
+    if (trace) {
+        trace->AddScanned(scanned);
+        trace->AddSkipped(skipped);
+    }
+}
+
+std::vector<int> ConjunctionScorer::GetMatchedDocid(size_t k, QueryTrace *trace) {
+    std::vector<int> ret;
+    auto sink = [&ret](int docid) { ret.push_back(docid); };
+    this->Match(k, sink, trace);
     return ret;
 }
 
+void ConjunctionScorer::GetTopK(size_t k, const ScoreFunction& score, TopKHeap& heap, QueryTrace *trace) {
+    auto sink = [&score, &heap](int docid) { heap.Push(docid, score(docid)); };
+    this->Match(k, sink, trace);
+}
+
+//
+// WAND over the K-intersection: the lists are sorted by docid, and a doc
+// before the pivot list is only on lists whose k largest bounds can't reach
+// the k-th score, so the lists ahead of the pivot skip straight to it
+//
+size_t ConjunctionScorer::GetTopKWeighted(size_t k, const ConjunctionWeights& weights, TopKHeap& heap, QueryTrace *trace) {
+    if (k == 0) {
+        k = 1;
+    }
+    if (plists_.size() < k) {
+        return 0;
+    }
+    int next_id;
+    size_t scanned = 0;
+    size_t skipped = 0;
+    size_t scored = 0;
+    std::vector<double> scores;
+    std::sort(plists_.begin(), plists_.end());
+    while (plists_[k - 1].CurrentEntry() != PostingList::EOL) {
+        if (heap.full()) {
+            int pivot = this->Pivot(k, heap.threshold());
+            if (pivot < 0) {
+                break;
+            }
+            int pivot_id = plists_[pivot].CurrentEntry().docid;
+            if (plists_[0].CurrentEntry().docid < pivot_id) {
+                for (int L = 0; L < pivot; ++L) {
+                    skipped += plists_[L].SkipTo(pivot_id);
+                }
+                std::sort(plists_.begin(), plists_.end());
+                continue;
+            }
+        }
+        ++scanned;
+        int docid = plists_[k - 1].CurrentEntry().docid;
+        if (plists_[0].CurrentEntry().docid == docid) {
+            next_id = docid + 1;
+            if (plists_[0].CurrentEntry().is_belong_to) {
+                // a doc on more than k lists, e.g. with several disjunctions
+                // of the same size, scores its k best ones
+                scores.clear();
+                for (size_t L = 0; L < plists_.size() && plists_[L].CurrentEntry().docid == docid; ++L) {
+                    scores.push_back(plists_[L].weight() * weights.Get(docid, plists_[L].field()));
+                }
+                std::partial_sort(scores.begin(), scores.begin() + k, scores.end(), std::greater<double>());
+                double score = 0.0;
+                for (size_t L = 0; L < k; ++L) {
+                    score += scores[L];
+                }
+                heap.Push(docid, score);
+                ++scored;
+            }
+            for (size_t L = k; L < plists_.size(); ++L) {
+                if (plists_[L].CurrentEntry().docid < next_id) {
+                    skipped += plists_[L].SkipTo(next_id);
+                } else {
+                    break;
+                }
+            }
+        } else {
+            next_id = docid;
+        }
+        for (size_t L = 0; L < k; ++L) {
+            skipped += plists_[L].SkipTo(next_id);
+        }
+        std::sort(plists_.begin(), plists_.end());
+    }
+    if (trace) {
+        trace->AddScanned(scanned);
+        trace->AddSkipped(skipped);
+    }
+    return scored;
+}
+
+int ConjunctionScorer::Pivot(size_t k, double threshold) {
+    // min-heap of the k largest bounds so far
+    bounds_.clear();
+    double sum = 0.0;
+    for (size_t i = 0; i < plists_.size() && plists_[i].CurrentEntry() != PostingList::EOL; ++i) {
+        double bound = plists_[i].upper_bound();
+        if (bounds_.size() < k) {
+            bounds_.push_back(bound);
+            std::push_heap(bounds_.begin(), bounds_.end(), std::greater<double>());
+            sum += bound;
+        } else if (bound > bounds_.front()) {
+            sum += bound - bounds_.front();
+            std::pop_heap(bounds_.begin(), bounds_.end(), std::greater<double>());
+            bounds_.back() = bound;
+            std::push_heap(bounds_.begin(), bounds_.end(), std::greater<double>());
+        }
+        // a doc scoring exactly the threshold may still win the tie by docid
+        if (i + 1 >= k && sum >= threshold) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void ConjunctionWeights::Set(int docid, int field, double weight) {
+    if (field < 0) {
+        return;
+    }
+    float value = static_cast<float>(std::max(weight, 0.0));
+    auto ret = weights_.insert(std::make_pair(Key(docid, field), value));
+    if (!ret.second) {
+        ret.first->second = std::max(ret.first->second, value);
+    }
+    if (static_cast<size_t>(field) >= max_.size()) {
+        max_.resize(field + 1, 1.0);
+    }
+    max_[field] = std::max(max_[field], static_cast<double>(value));
+}
+
 } // namespace cloris
@@ -7,13 +7,43 @@
 #ifndef CLORIS_CONJUNCTION_SCORER_H_
 #define CLORIS_CONJUNCTION_SCORER_H_
 
+#include <stdint.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 #include <list>
+#include "internal/query_trace.h"
+#include "internal/top_k.h"
 #include "posting_list.h"
 
 namespace cloris {
 
+//
+// conjunction weights of the docs of one partition by (docid, field), for
+// the weighted search. Most conjunctions keep the default weight 1, only
+// the others are stored
+//
+class ConjunctionWeights {
+public:
+    double Get(int docid, int field) const {
+        auto iter = weights_.find(Key(docid, field));
+        return (iter == weights_.end()) ? 1.0 : iter->second;
+    }
+    // a doc with several weighted conjunctions on the field keeps the largest
+    void Set(int docid, int field, double weight);
+    // upper bound of the weights of 'field'
+    double max(int field) const {
+        return (field >= 0 && static_cast<size_t>(field) < max_.size()) ? max_[field] : 1.0;
+    }
+    size_t size() const { return weights_.size(); }
+private:
+    static uint64_t Key(int docid, int field) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(docid)) << 16) | static_cast<uint16_t>(field);
+    }
+    std::unordered_map<uint64_t, float> weights_;
+    std::vector<double> max_;
+};
+
 // refer to lucene implementation
 // Conjunction Algorithm refered from << indexing boolean expression >>
 // 每个倒排链起名叫posting list
@@ -21,10 +51,32 @@ class ConjunctionScorer {
 public:
     ConjunctionScorer() {}
     ~ConjunctionScorer(); 
-    std::vector<int> GetMatchedDocid(size_t k);
+    // scorer counters are added to 'trace' if it is not NULL
+    std::vector<int> GetMatchedDocid(size_t k, QueryTrace *trace = NULL);
+    // push the matched docs into 'heap' with their scores instead of listing them
+    void GetTopK(size_t k, const ScoreFunction& score, TopKHeap& heap, QueryTrace *trace = NULL);
+    // scored boolean expression retrieval: a match scores the sum of its
+    // conjunction weights times the query term weights of its k best lists. Once
+    // the heap is full, docs whose lists can't reach the k-th score are
+    // skipped WAND-style without being evaluated. Returns the docs scored
+    size_t GetTopKWeighted(size_t k, const ConjunctionWeights& weights, TopKHeap& heap, QueryTrace *trace = NULL);
+    // score info of the list added last, see PostingList::set_score_info
+    void SetScoreInfo(int field, double weight, double upper_bound) {
+        plists_.back().set_score_info(field, weight, upper_bound);
+    }
+    size_t size() const { return plists_.size(); }
     void AddPostingList(std::list<DocidNode>* doc_list, const ReclaimHandler& handler);
+    void AddPostingList(const DocListGroup& group);
 private:
+    // the conjunction algorithm, 'sink' is called with every matched docid
+    template <typename Sink>
+    void Match(size_t k, Sink& sink, QueryTrace *trace);
+    // the first list of the pivot: the smallest i such that the k largest
+    // upper bounds of lists [0, i] reach 'threshold', -1 if there is none
+    int Pivot(size_t k, double threshold);
+
     std::vector<PostingList> plists_;
+    std::vector<double> bounds_; // scratch of Pivot
 };
 
 } // namespace cloris
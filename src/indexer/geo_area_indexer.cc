@@ -0,0 +1,289 @@
+//
+// geo area indexer main class definition
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <math.h>
+#include <algorithm>
+#include "geohash.h"
+#include "internal/log.h"
+#include "geo_area_indexer.h"
+
+// Relate() may only say INSIDE or OUTSIDE when it is sure, distances on the
+// rectangle are estimated from its corners, so keep a margin on both sides
+#define GEO_AREA_CIRCLE_MARGIN  0.01
+
+namespace cloris {
+
+GeoArea::GeoArea(int docid, bool is_belong_to, double lon, double lat, double radius)
+    : docid_(docid),
+      is_belong_to_(is_belong_to),
+      is_circle_(true),
+      lon_(lon),
+      lat_(lat),
+      radius_(radius) {
+    geohashBoundingBox(lon, lat, radius * (1 + GEO_AREA_CIRCLE_MARGIN), bounds_);
+}
+
+GeoArea::GeoArea(int docid, bool is_belong_to, const std::vector<std::pair<double, double>>& points)
+    : docid_(docid),
+      is_belong_to_(is_belong_to),
+      is_circle_(false),
+      lon_(0),
+      lat_(0),
+      radius_(0),
+      points_(points) {
+    bounds_[0] = bounds_[2] = points[0].first;
+    bounds_[1] = bounds_[3] = points[0].second;
+    for (auto& p : points_) {
+        bounds_[0] = std::min(bounds_[0], p.first);
+        bounds_[1] = std::min(bounds_[1], p.second);
+        bounds_[2] = std::max(bounds_[2], p.first);
+        bounds_[3] = std::max(bounds_[3], p.second);
+    }
+}
+
+// polygons are tested in the lon/lat plane by ray casting
+bool GeoArea::Contains(double lon, double lat) const {
+    if (is_circle_) {
+        return geohashGetDistance(lon_, lat_, lon, lat) <= radius_;
+    }
+    bool inside = false;
+    for (size_t i = 0, j = points_.size() - 1; i < points_.size(); j = i++) {
+        const std::pair<double, double>& a = points_[i];
+        const std::pair<double, double>& b = points_[j];
+        if ((a.second > lat) != (b.second > lat) &&
+                lon < (b.first - a.first) * (lat - a.second) / (b.second - a.second) + a.first) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+// whether any polygon edge touches the closed rectangle (Liang-Barsky clipping)
+bool GeoArea::SegmentCrosses(const GeoHashArea& rect) const {
+    for (size_t i = 0, j = points_.size() - 1; i < points_.size(); j = i++) {
+        double x0 = points_[j].first, y0 = points_[j].second;
+        double dx = points_[i].first - x0, dy = points_[i].second - y0;
+        double p[4] = { -dx, dx, -dy, dy };
+        double q[4] = { x0 - rect.longitude.min, rect.longitude.max - x0,
+                        y0 - rect.latitude.min,  rect.latitude.max - y0 };
+        double t0 = 0, t1 = 1;
+        bool crosses = true;
+        for (int k = 0; k < 4 && crosses; ++k) {
+            if (p[k] == 0) {
+                crosses = (q[k] >= 0);
+            } else if (p[k] < 0) {
+                t0 = std::max(t0, q[k] / p[k]);
+            } else {
+                t1 = std::min(t1, q[k] / p[k]);
+            }
+        }
+        if (crosses && t0 <= t1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+GeoArea::Relation GeoArea::Relate(const GeoHashArea& rect) const {
+    if (rect.longitude.max < bounds_[0] || rect.longitude.min > bounds_[2] ||
+            rect.latitude.max < bounds_[1] || rect.latitude.min > bounds_[3]) {
+        return OUTSIDE;
+    }
+    if (is_circle_) {
+        double lon = std::min(std::max(lon_, rect.longitude.min), rect.longitude.max);
+        double lat = std::min(std::max(lat_, rect.latitude.min), rect.latitude.max);
+        if (geohashGetDistance(lon_, lat_, lon, lat) > radius_ * (1 + GEO_AREA_CIRCLE_MARGIN)) {
+            return OUTSIDE;
+        }
+        double inner = radius_ * (1 - GEO_AREA_CIRCLE_MARGIN);
+        if (geohashGetDistance(lon_, lat_, rect.longitude.min, rect.latitude.min) <= inner &&
+                geohashGetDistance(lon_, lat_, rect.longitude.min, rect.latitude.max) <= inner &&
+                geohashGetDistance(lon_, lat_, rect.longitude.max, rect.latitude.min) <= inner &&
+                geohashGetDistance(lon_, lat_, rect.longitude.max, rect.latitude.max) <= inner) {
+            return INSIDE;
+        }
+        return PARTIAL;
+    }
+    if (this->SegmentCrosses(rect)) {
+        return PARTIAL;
+    }
+    // no edge touches the rectangle: it is inside or outside as a whole,
+    // unless the whole polygon sits in it
+    if (points_[0].first >= rect.longitude.min && points_[0].first <= rect.longitude.max &&
+            points_[0].second >= rect.latitude.min && points_[0].second <= rect.latitude.max) {
+        return PARTIAL;
+    }
+    double lon = (rect.longitude.min + rect.longitude.max) / 2;
+    double lat = (rect.latitude.min + rect.latitude.max) / 2;
+    return this->Contains(lon, lat) ? INSIDE : OUTSIDE;
+}
+
+bool GeoArea::StartCells(std::vector<GeoHashBits>& cells) const {
+    double min_lon = std::max(bounds_[0], (double)GEO_LONG_MIN);
+    double max_lon = std::min(bounds_[2], (double)GEO_LONG_MAX);
+    double min_lat = std::max(bounds_[1], GEO_LAT_MIN);
+    double max_lat = std::min(bounds_[3], GEO_LAT_MAX);
+    if (min_lon > max_lon || min_lat > max_lat) {
+        return false;
+    }
+    uint8_t step = 1;
+    while (step < GEO_STEP_MAX &&
+            (GEO_LONG_MAX - GEO_LONG_MIN) / (double)(1ULL << (step + 1)) >= max_lon - min_lon &&
+            (GEO_LAT_MAX - GEO_LAT_MIN) / (double)(1ULL << (step + 1)) >= max_lat - min_lat) {
+        ++step;
+    }
+    double n = (double)(1ULL << step);
+    double width = (GEO_LONG_MAX - GEO_LONG_MIN) / n;
+    double height = (GEO_LAT_MAX - GEO_LAT_MIN) / n;
+    int64_t x0 = (int64_t)((min_lon - GEO_LONG_MIN) / width);
+    int64_t x1 = std::min((int64_t)((max_lon - GEO_LONG_MIN) / width), (int64_t)n - 1);
+    int64_t y0 = (int64_t)((min_lat - GEO_LAT_MIN) / height);
+    int64_t y1 = std::min((int64_t)((max_lat - GEO_LAT_MIN) / height), (int64_t)n - 1);
+    for (int64_t x = x0; x <= x1; ++x) {
+        for (int64_t y = y0; y <= y1; ++y) {
+            GeoHashBits hash;
+            geohashEncodeWGS84(GEO_LONG_MIN + (x + 0.5) * width, GEO_LAT_MIN + (y + 0.5) * height, step, &hash);
+            cells.push_back(hash);
+        }
+    }
+    return true;
+}
+
+GeoAreaIndexer::GeoAreaIndexer(const std::string& name) : Indexer(name), level_mask_(0) {
+    type_ = ValueType::GEORANGE;
+}
+
+bool GeoAreaIndexer::ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value) {
+    for (auto& p : value.geo_circle()) {
+        terms.push_back(Term(GeoRange(p.lon(), p.lat(), p.radius())));
+    }
+    return true;
+}
+
+bool GeoAreaIndexer::Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental) {
+    for (auto& p : value.geo_circle()) {
+        if (p.radius() <= 0) {
+            cLog(WARN, "[geo_area_indexer warning] bad radius %f, docid=%d", p.radius(), docid);
+            continue;
+        }
+        this->AddArea(GeoArea(docid, is_belong_to, p.lon(), p.lat(), p.radius()));
+    }
+    for (auto& p : value.geo_polygon()) {
+        if (p.points_size() < 3) {
+            cLog(WARN, "[geo_area_indexer warning] polygon needs 3 points at least, docid=%d", docid);
+            continue;
+        }
+        std::vector<std::pair<double, double>> points;
+        for (auto& point : p.points()) {
+            points.push_back(std::make_pair(point.lon(), point.lat()));
+        }
+        this->AddArea(GeoArea(docid, is_belong_to, points));
+    }
+    return true;
+}
+
+bool GeoAreaIndexer::AddArea(const GeoArea& area) {
+    std::vector<GeoHashBits> cells;
+    if (!area.StartCells(cells)) {
+        cLog(WARN, "[geo_area_indexer warning] area out of range, docid=%d", area.docid());
+        return false;
+    }
+    uint8_t max_step = std::min(cells[0].step + GEO_AREA_REFINE_LEVELS, GEO_STEP_MAX);
+    uint32_t area_id = static_cast<uint32_t>(areas_.size());
+    areas_.push_back(area);
+    area_lists_.push_back(InvertedList());
+    area_lists_.back().Add(area.is_belong_to(), area.docid());
+    for (auto& hash : cells) {
+        this->Cover(area_id, hash, max_step);
+    }
+    cLog(DEBUG, "[geo_area_indexer] add area, docid=%d, levels=[%d, %d]", area.docid(), cells[0].step, max_step);
+    return true;
+}
+
+void GeoAreaIndexer::Cover(uint32_t area_id, GeoHashBits hash, uint8_t max_step) {
+    GeoHashArea rect;
+    geohashDecodeWGS84(hash, &rect);
+    const GeoArea& area = areas_[area_id];
+    GeoArea::Relation relation = area.Relate(rect);
+    if (relation == GeoArea::OUTSIDE) {
+        return;
+    }
+    if (relation == GeoArea::INSIDE) {
+        cells_[hash.step][hash.bits].interior.Add(area.is_belong_to(), area.docid());
+    } else if (hash.step >= max_step) {
+        cells_[hash.step][hash.bits].boundary.push_back(area_id);
+    } else {
+        for (uint64_t child = 0; child < 4; ++child) {
+            GeoHashBits child_hash = { (hash.bits << 2) | child, (uint8_t)(hash.step + 1) };
+            this->Cover(area_id, child_hash, max_step);
+        }
+        return;
+    }
+    level_mask_ |= (1U << hash.step);
+}
+
+// a doc hit on several levels or by several areas is merged by the scorer
+void GeoAreaIndexer::GetPostingLists(const Term& term, DocListGroup& group) {
+    if (term.type() != ValueType::GEORANGE) {
+        cLog(ERROR, "[geo_area_indexer] (GetPostingLists) bad term type");
+        return;
+    }
+    double lon = term.longitude();
+    double lat = term.latitude();
+    GeoHashBits hash;
+    GeoHashFixedCoord coord;
+    if (!geohashToFixed(lon, lat, &coord)) {
+        return;
+    }
+    geohashEncodeFixed(&coord, GEO_STEP_MAX, &hash);
+    for (uint8_t step = 1; step <= GEO_STEP_MAX; ++step) {
+        if (!(level_mask_ & (1U << step))) {
+            continue;
+        }
+        auto iter = cells_[step].find(hash.bits >> ((GEO_STEP_MAX - step) * 2));
+        if (iter == cells_[step].end()) {
+            continue;
+        }
+        GeoAreaCell& cell = iter->second;
+        if (cell.interior.length() > 0) {
+            group.push_back(&(cell.interior.mutable_doc_list()));
+        }
+        for (auto area_id : cell.boundary) {
+            if (areas_[area_id].Contains(lon, lat)) {
+                group.push_back(&(area_lists_[area_id].mutable_doc_list()));
+            }
+        }
+    }
+}
+
+std::list<DocidNode>* GeoAreaIndexer::GetPostingLists(const Term& term) {
+    DocListGroup group;
+    this->GetPostingLists(term, group);
+    return (group.size() == 1) ? group[0] : NULL;
+}
+
+void GeoAreaIndexer::GetStats(IndexerStats& stats) const {
+    stats.keys += areas_.size();
+    stats.bytes += areas_.capacity() * sizeof(GeoArea) + area_lists_.capacity() * sizeof(InvertedList)
+                   + area_lists_.size() * POSTING_NODE_BYTES;
+    for (auto& area : areas_) {
+        stats.bytes += area.points().capacity() * sizeof(std::pair<double, double>);
+    }
+    for (uint8_t step = 1; step <= GEO_STEP_MAX; ++step) {
+        stats.keys += cells_[step].size();
+        stats.bytes += cells_[step].bucket_count() * sizeof(void*);
+        for (auto& p : cells_[step]) {
+            const GeoAreaCell& cell = p.second;
+            if (cell.interior.length() > 0) {
+                stats.AddList(cell.interior.length());
+            }
+            stats.bytes += sizeof(p) + HASH_NODE_BYTES + cell.interior.length() * POSTING_NODE_BYTES
+                           + cell.boundary.capacity() * sizeof(uint32_t);
+        }
+    }
+}
+
+} // namespace cloris
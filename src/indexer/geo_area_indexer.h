@@ -0,0 +1,107 @@
+//
+// geo area indexer main class definition
+// Reverse geo targeting, e.g. location ∈ {3km around store X, delivery polygon Y}
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+// GeoIndexer indexes ad points and lets the query bring the radius. Here the
+// ad brings the area (circles or polygons) and the query is the user's point.
+//
+// every area is covered at index time by geohash cells of a few levels: the
+// start level is chosen so that the bounding box spans at most 2x2 cells, a
+// cell is split into its 4 children until it is fully inside the area
+// (interior cell) or the refine depth is used up (boundary cell). Interior
+// cells keep a plain doc list, boundary cells keep the area ids to test.
+//
+// a point search takes one lookup per level in use, the geohash of a level
+// is a prefix of the 52-bit geohash of the point, so it is encoded only once.
+// The interior lists of the hit cells go to the scorer as they are, an area
+// hit in a boundary cell adds its own one-doc list, so nothing is allocated
+// per search
+//
+
+#ifndef CLORIS_GEO_AREA_INDEXER_H_
+#define CLORIS_GEO_AREA_INDEXER_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include "inverted_list.h"
+#include "geohash_helper.h"
+#include "indexer.h"
+
+// levels below the start level an area is refined to
+#define GEO_AREA_REFINE_LEVELS  4
+
+namespace cloris {
+
+class GeoArea {
+public:
+    enum Relation {
+        OUTSIDE = 0,
+        INSIDE  = 1,
+        PARTIAL = 2,
+    };
+    GeoArea(int docid, bool is_belong_to, double lon, double lat, double radius);
+    GeoArea(int docid, bool is_belong_to, const std::vector<std::pair<double, double>>& points);
+    ~GeoArea() {}
+    // exact test
+    bool Contains(double lon, double lat) const;
+    // relation with a lon/lat rectangle, PARTIAL when not sure
+    Relation Relate(const GeoHashArea& rect) const;
+    // cells of the finest level whose cells are not smaller than the bounding
+    // box, at most 2x2 of them cover the area. Returns false if the area is
+    // out of the geohash range
+    bool StartCells(std::vector<GeoHashBits>& cells) const;
+    // [min_lon, min_lat, max_lon, max_lat]
+    const double* bounds() const { return bounds_; }
+    // polygon vertices, (lon, lat)
+    const std::vector<std::pair<double, double>>& points() const { return points_; }
+    int docid() const { return docid_; }
+    bool is_belong_to() const { return is_belong_to_; }
+private:
+    bool SegmentCrosses(const GeoHashArea& rect) const;
+
+    int docid_;
+    bool is_belong_to_;
+    bool is_circle_;
+    double lon_;
+    double lat_;
+    double radius_;
+    std::vector<std::pair<double, double>> points_; // polygon vertices, (lon, lat)
+    double bounds_[4];
+};
+
+struct GeoAreaCell {
+    InvertedList interior;
+    std::vector<uint32_t> boundary; // ids of areas to test
+};
+
+class GeoAreaIndexer : public Indexer {
+public:
+    GeoAreaIndexer(const std::string& name);
+    ~GeoAreaIndexer() {}
+    // circles only, polygons can not be expressed as a Term
+    virtual bool ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value);
+    virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental);
+    // a point may hit several cells and areas, use the DocListGroup version
+    virtual std::list<DocidNode>* GetPostingLists(const Term& term);
+    virtual void GetPostingLists(const Term& term, DocListGroup& group);
+    virtual const char* index_type() const { return "geo_area"; }
+    // keys are areas and cells, lists are the interior lists of the cells
+    virtual void GetStats(IndexerStats& stats) const;
+private:
+    bool AddArea(const GeoArea& area);
+    void Cover(uint32_t area_id, GeoHashBits hash, uint8_t max_step);
+    GeoAreaIndexer() = delete;
+
+    std::vector<GeoArea> areas_;
+    std::vector<InvertedList> area_lists_; // by area id, the doc of the area
+    std::unordered_map<uint64_t, GeoAreaCell> cells_[GEO_STEP_MAX + 1]; // by level
+    uint32_t level_mask_; // bit i is set if level i has cells
+};
+
+} // namespace cloris
+
+#endif // CLORIS_GEO_AREA_INDEXER_H_
@@ -4,15 +4,22 @@
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <math.h>
+#include <algorithm>
 #include "geohash.h"
 #include "internal/log.h"
 #include "geo_indexer.h"
+#include "geo_area_indexer.h"
 
 namespace cloris {
 
-GeoIndexer::GeoIndexer(const std::string &name) : Indexer(name) {
+GeoIndexer::GeoIndexer(const std::string &name)
+    : Indexer(name),
+      is_compiled_(false),
+      caches_(NULL),
+      partition_(0),
+      generation_(0) {
     type_ = ValueType::GEORANGE;
-    reclaim_handler_ = GeoIndexer::ReclaimPostingList;
 }
 
 GeoIndexer::~GeoIndexer() {
@@ -23,27 +30,49 @@ GeoIndexer::~GeoIndexer() {
 bool GeoIndexer::Add(const Term& term, bool is_belong_to, int docid) {
     /* Turn the coordinates into the score of the element. */
     GeoHashBits hash;
+    GeoHashFixedCoord coord;
     double lon = term.longitude();
     double lat = term.latitude();
 
-    // geohashEncodeWGS84(term.longitude(), term.latitude(), GEO_STEP_MAX, &hash);
-    geohashEncodeWGS84(lon, lat, GEO_STEP_MAX, &hash);
+    if (!geohashToFixed(lon, lat, &coord)) {
+        cLog(WARN, "[geo_indexer warning] bad coordinate, lon=%f, lat=%f", lon, lat);
+        return false;
+    }
+    geohashEncodeFixed(&coord, GEO_STEP_MAX, &hash);
     GeoHashFix52Bits bits = geohashAlign52Bits(hash);
     // add to skip_list
     GeoNode node(bits);
+    ++generation_;
+    if (is_compiled_) {
+        compiled_.Clear();
+        is_compiled_ = false;
+    }
     typename goodliffe::skip_list<GeoNode>::iterator iter = inverted_lists_.find(node);
+    const GeoNode *cell = NULL;
     // not found
     if (iter == inverted_lists_.end()) {
         cLog(DEBUG, "inverted_lists_ not found");
+        if (!node.Locate()) {
+            cLog(WARN, "[geo_indexer warning] bad coordinate, lon=%f, lat=%f", lon, lat);
+            return false;
+        }
         node.Add(is_belong_to, docid);
         typename goodliffe::skip_list<GeoNode>::insert_by_value_result insert_rslt = inverted_lists_.insert(node);
         if (insert_rslt.second) {
             cLog(DEBUG, "skip_list insert success, node=");
+            cell = &(*insert_rslt.first);
         } else {
             cLog(DEBUG, "skip_list insert failed");
         }
     } else {
         iter->Add(is_belong_to, docid);
+        cell = &(*iter);
+    }
+    if (cell && is_belong_to) {
+        std::vector<const GeoNode*>& cells = doc_cells_[docid];
+        if (std::find(cells.begin(), cells.end(), cell) == cells.end()) {
+            cells.push_back(cell);
+        }
     }
     return true; 
 }
@@ -54,6 +83,15 @@ bool GeoIndexer::ParseTermsFromConjValue(std::vector<Term>& terms, const ConjVal
        // Term tm(range); 
         terms.push_back(tm);
     }
+    for (auto& p : value.geos()) {
+        terms.push_back(Term(GeoRange(p.lon(), p.lat())));
+    }
+    if (value.geo_points_size() % 2 != 0) {
+        cLog(WARN, "[geo_indexer warning] odd size of geo_points, the last one is ignored");
+    }
+    for (int i = 0; i + 1 < value.geo_points_size(); i += 2) {
+        terms.push_back(Term(GeoRange(value.geo_points(i), value.geo_points(i + 1))));
+    }
     return true;
 }
 
@@ -71,27 +109,195 @@ bool GeoIndexer::Add(const ConjValue& value, bool is_belong_to, int docid, bool
 /* ====================================================================
  * Helpers
  * ==================================================================== */
-int decodeGeohash(double bits, double *xy) {
-    GeoHashBits hash = { .bits = (uint64_t)bits, .step = GEO_STEP_MAX };
+int decodeGeohash(GeoHashFix52Bits bits, double *xy) {
+    GeoHashBits hash = { .bits = bits, .step = GEO_STEP_MAX };
     return geohashDecodeToLongLatWGS84(hash, xy);
 }
 
-void geoAppendIfWithinRadius(std::list<DocidNode>* lptr, double lon, double lat, double radius, const GeoNode& cur_node) {
-    double distance, xy[2];
-    double score = cur_node.geo_bits();
-    if (!decodeGeohash(score, xy)) {
+// same constants as geohash_helper.cc
+static const double GEO_D_R = (M_PI / 180.0);
+static const double GEO_EARTH_RADIUS_IN_METERS = 6372797.560856;
+
+bool GeoNode::Locate() {
+    double xy[2];
+    if (!decodeGeohash(geo_bits_, xy)) {
         cLog(DEBUG, "docodeGeohash failed");
+        return false;
+    }
+    lon_rad_ = xy[0] * GEO_D_R;
+    lat_rad_ = xy[1] * GEO_D_R;
+    cos_lat_ = cos(lat_rad_);
+    return true;
+}
+
+// the candidates of one search, reused by the searches of a thread
+static thread_local GeoCandidates t_candidates;
+
+static GeoCandidates& ScratchCandidates() {
+    t_candidates.Clear();
+    return t_candidates;
+}
+
+void GeoCandidates::Clear() {
+    blocks_.clear();
+    lon_rads_.clear();
+    lat_rads_.clear();
+    cos_lats_.clear();
+    nodes_.clear();
+    size_ = 0;
+}
+
+void GeoCandidates::Append(GeoNode& node) {
+    lon_rads_.push_back(node.lon_rad());
+    lat_rads_.push_back(node.lat_rad());
+    cos_lats_.push_back(node.cos_lat());
+    nodes_.push_back(&node);
+    ++size_;
+}
+
+void GeoCandidates::Append(const double *lon_rads, const double *lat_rads, const double *cos_lats,
+        GeoNode *const *nodes, size_t size) {
+    if (size == 0) {
         return;
     }
-    if (!geohashGetDistanceIfInRadiusWGS84(lon,lat, xy[0], xy[1], radius, &distance)) {
-        cLog(DEBUG, "getDistancec failed, distance=%f", distance);
+    Block block = { lon_rads, lat_rads, cos_lats, nodes, size };
+    blocks_.push_back(block);
+    size_ += size;
+}
+
+template <typename Visit>
+void GeoCandidates::ForEachBlock(Visit visit) const {
+    for (auto& block : blocks_) {
+        visit(block);
+    }
+    if (!nodes_.empty()) {
+        Block gathered = { lon_rads_.data(), lat_rads_.data(), cos_lats_.data(), nodes_.data(), nodes_.size() };
+        visit(gathered);
+    }
+}
+
+//
+// haversine as in geohashGetDistance, but compared before asin/sqrt:
+//     d <= radius  <==>  u^2 + cos(lat1) * cos(lat2) * v^2 <= sin^2(radius / 2R)
+// a great circle is never shorter than its latitude span, so nodes outside
+// the latitude band are dropped first by a loop without any libm call, which
+// the compiler can vectorize. Blocks go in chunks, so the band flags stay on
+// the stack
+//
+template <typename Visit>
+void GeoCandidates::Within(double lon, double lat, double radius, Visit visit) const {
+    double half_angle = radius / (2.0 * GEO_EARTH_RADIUS_IN_METERS);
+    double max_dlat = HUGE_VAL;
+    double max_h = HUGE_VAL;
+    if (half_angle < M_PI / 2) {
+        max_dlat = half_angle * 2.0;
+        max_h = sin(half_angle) * sin(half_angle);
+    }
+    double lon1 = lon * GEO_D_R;
+    double lat1 = lat * GEO_D_R;
+    double cos_lat1 = cos(lat1);
+
+    this->ForEachBlock([&](const Block& block) {
+        char in_band[GEO_FILTER_CHUNK];
+        for (size_t base = 0; base < block.size; base += GEO_FILTER_CHUNK) {
+            size_t n = std::min(block.size - base, static_cast<size_t>(GEO_FILTER_CHUNK));
+            const double *lat_rads = block.lat_rads + base;
+            for (size_t i = 0; i < n; ++i) {
+                in_band[i] = (fabs(lat_rads[i] - lat1) <= max_dlat);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (!in_band[i]) {
+                    continue;
+                }
+                double u = sin((lat_rads[i] - lat1) / 2);
+                double v = sin((block.lon_rads[base + i] - lon1) / 2);
+                double h = u * u + cos_lat1 * block.cos_lats[base + i] * v * v;
+                if (h <= max_h) {
+                    visit(block.nodes[base + i], h);
+                }
+            }
+        }
+    });
+}
+
+void GeoCandidates::Filter(double lon, double lat, double radius, DocListGroup& group) const {
+    this->Within(lon, lat, radius, [&group](GeoNode *node, double h) {
+        group.push_back(&(node->list().mutable_doc_list()));
+    });
+}
+
+void GeoCandidates::Filter(const GeoArea& area, DocListGroup& group) const {
+    this->ForEachBlock([&area, &group](const Block& block) {
+        for (size_t i = 0; i < block.size; ++i) {
+            if (area.Contains(block.lon_rads[i] / GEO_D_R, block.lat_rads[i] / GEO_D_R)) {
+                group.push_back(&(block.nodes[i]->list().mutable_doc_list()));
+            }
+        }
+    });
+}
+
+void CompiledGeoCells::Clear() {
+    std::vector<GeoHashFix52Bits>().swap(keys_);
+    std::vector<double>().swap(lon_rads_);
+    std::vector<double>().swap(lat_rads_);
+    std::vector<double>().swap(cos_lats_);
+    std::vector<GeoNode*>().swap(nodes_);
+    std::vector<uint32_t>().swap(directory_);
+    prefix_bits_ = 0;
+}
+
+void CompiledGeoCells::Append(GeoNode& node) {
+    keys_.push_back(node.geo_bits());
+    lon_rads_.push_back(node.lon_rad());
+    lat_rads_.push_back(node.lat_rad());
+    cos_lats_.push_back(node.cos_lat());
+    nodes_.push_back(&node);
+}
+
+// about one cell per directory slot, at most 64K slots
+void CompiledGeoCells::Seal() {
+    prefix_bits_ = 1;
+    while (prefix_bits_ < 16 && (static_cast<size_t>(1) << prefix_bits_) < keys_.size()) {
+        ++prefix_bits_;
+    }
+    size_t slots = static_cast<size_t>(1) << prefix_bits_;
+    int shift = 52 - prefix_bits_;
+    directory_.assign(slots + 1, 0);
+    size_t pos = 0;
+    for (size_t prefix = 0; prefix <= slots; ++prefix) {
+        while (pos < keys_.size() && (keys_[pos] >> shift) < prefix) {
+            ++pos;
+        }
+        directory_[prefix] = static_cast<uint32_t>(pos);
+    }
+}
+
+size_t CompiledGeoCells::LowerBound(GeoHashFix52Bits key) const {
+    GeoHashFix52Bits prefix = key >> (52 - prefix_bits_);
+    if (prefix >= directory_.size() - 1) {
+        return keys_.size();
+    }
+    const GeoHashFix52Bits *base = keys_.data();
+    return std::lower_bound(base + directory_[prefix], base + directory_[prefix + 1], key) - base;
+}
+
+void CompiledGeoCells::GetCellsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, GeoCandidates& candidates) const {
+    if (keys_.empty()) {
         return;
     }
-    cLog(DEBUG, "getDistancec succcess, distance=%f", distance);
-    for (auto& p : cur_node.list().doc_list()) {
-        lptr->push_back(p);
-    } 
-    return;
+    this->AppendCandidates(LowerBound(min), LowerBound(max), candidates);
+}
+
+void CompiledGeoCells::AppendCandidates(size_t begin, size_t end, GeoCandidates& candidates) const {
+    if (begin < end) {
+        candidates.Append(&lon_rads_[begin], &lat_rads_[begin], &cos_lats_[begin], &nodes_[begin], end - begin);
+    }
+}
+
+void CompiledGeoCells::AppendDocLists(size_t begin, size_t end, DocListGroup& group) const {
+    for (size_t pos = begin; pos < end; ++pos) {
+        group.push_back(&(nodes_[pos]->list().mutable_doc_list()));
+    }
 }
 
 /* Query a Redis sorted set to extract all the elements between 'min' and
@@ -106,8 +312,11 @@ void geoAppendIfWithinRadius(std::list<DocidNode>* lptr, double lon, double lat,
  * using multiple queries to the sorted set, that we later need to sort
  * via qsort. Similarly we need to be able to reject points outside the search
  * radius area ASAP in order to allocate and process more points than needed. */
-void GeoIndexer::GetGeoPointsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, 
-        double lon, double lat, double radius, std::list<DocidNode> *lptr) {
+void GeoIndexer::GetGeoPointsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, GeoCandidates& candidates) {
+    if (is_compiled_) {
+        compiled_.GetCellsInRange(min, max, candidates);
+        return;
+    }
     GeoNode min_node(min);
     GeoNode max_node(max);
     typename goodliffe::skip_list<GeoNode>::iterator iter = inverted_lists_.find_first_in_range(min_node, max_node);
@@ -124,11 +333,24 @@ void GeoIndexer::GetGeoPointsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max,
             break;
         }
         cLog(DEBUG, "node in MATCH");
-        geoAppendIfWithinRadius(lptr, lon, lat, radius, *iter);
+        candidates.Append(*iter);
         ++iter;
     }
 }
 
+void GeoIndexer::GetDocListsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, DocListGroup& group) {
+    if (is_compiled_) {
+        compiled_.AppendDocLists(compiled_.LowerBound(min), compiled_.LowerBound(max), group);
+        return;
+    }
+    GeoNode min_node(min);
+    GeoNode max_node(max);
+    typename goodliffe::skip_list<GeoNode>::iterator iter = inverted_lists_.find_first_in_range(min_node, max_node);
+    for (; iter != this->inverted_lists_.end() && !(*iter >= max_node); ++iter) {
+        group.push_back(&(iter->list().mutable_doc_list()));
+    }
+}
+
 /* Compute the sorted set scores min (inclusive), max (exclusive) we should
  * query in order to retrieve all the elements inside the specified area
  * 'hash'. The two scores are returned by reference in *min and *max. */
@@ -161,14 +383,14 @@ void scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix52Bit
 /* Obtain all members between the min/max of this geohash bounding box.
  * Populate a geoArray of GeoPoints by calling GetGeoPointsInRange().
  * Return the number of points added to the array. */
-void GeoIndexer::GetMembersOfGeoHashBox(GeoHashBits hash, std::list<DocidNode> *lptr, double lon, double lat, double radius) {
+void GeoIndexer::GetMembersOfGeoHashBox(GeoHashBits hash, GeoCandidates& candidates) {
     GeoHashFix52Bits min, max;
     scoresOfGeoHashBox(hash,&min,&max);
-    GetGeoPointsInRange(min, max, lon, lat, radius, lptr);
+    GetGeoPointsInRange(min, max, candidates);
 }
 
 /* Search all eight neighbors + self geohash box */
-void GeoIndexer::GetMembersOfAllNeighbors(const GeoHashRadius& n, double lon, double lat, double radius, std::list<DocidNode>* lptr) {
+void GeoIndexer::GetMembersOfAllNeighbors(const GeoHashRadius& n, GeoCandidates& candidates) {
     GeoHashBits neighbors[9];
     unsigned int i, last_processed = 0;
 
@@ -198,34 +420,270 @@ void GeoIndexer::GetMembersOfAllNeighbors(const GeoHashRadius& n, double lon, do
         {
             continue;
         }
-        this->GetMembersOfGeoHashBox(neighbors[i], lptr, lon, lat, radius);
+        this->GetMembersOfGeoHashBox(neighbors[i], candidates);
         last_processed = i;
     }
 }
 
-void GeoIndexer::ReclaimPostingList(std::list<DocidNode>* lptr) {
-    delete lptr;
+//
+// adaptive cover on the compiled snapshot: a box fully inside the circle is
+// taken without any distance check (unless no group is given), a box crossing the circle is split into
+// its 4 children while it holds many points, so dense areas are refined and
+// sparse or huge ones stay coarse
+//
+void GeoIndexer::CoverCircle(const GeoArea& circle, GeoHashBits hash, GeoCandidates& candidates, DocListGroup* group) {
+    GeoHashFix52Bits min, max;
+    scoresOfGeoHashBox(hash, &min, &max);
+    size_t begin = compiled_.LowerBound(min);
+    size_t end = compiled_.LowerBound(max);
+    if (begin == end) {
+        return;
+    }
+    GeoHashArea rect;
+    geohashDecodeWGS84(hash, &rect);
+    GeoArea::Relation relation = circle.Relate(rect);
+    if (relation == GeoArea::OUTSIDE) {
+        return;
+    } else if (relation == GeoArea::INSIDE && group) {
+        compiled_.AppendDocLists(begin, end, *group);
+    } else if (relation == GeoArea::INSIDE || end - begin <= GEO_COVER_SCAN_CELLS || hash.step >= GEO_STEP_MAX) {
+        compiled_.AppendCandidates(begin, end, candidates);
+    } else {
+        for (uint64_t child = 0; child < 4; ++child) {
+            GeoHashBits child_hash = { (hash.bits << 2) | child, (uint8_t)(hash.step + 1) };
+            this->CoverCircle(circle, child_hash, candidates, group);
+        }
+    }
 }
 
-std::list<DocidNode>* GeoIndexer::GetPostingLists(const Term& term) {
+//
+// every geohash node holds a docid-sorted list, the scorer merges the group
+// lazily so the result stays sorted even though nodes come in geohash order
+//
+void GeoIndexer::GetPostingLists(const Term& term, DocListGroup& group) {
+    if (term.type() == ValueType::GEOFENCE) {
+        this->SearchFence(term, group);
+        return;
+    }
     if (term.type() != ValueType::GEORANGE) {
         cLog(ERROR, "[geo_indexer] (GetPostingLists) bad term type");
-        return NULL;
+        return;
     }
     double longitude = term.longitude();
     double latitude  = term.latitude();
     double radius_mters   = term.radius();
-    GeoHashRadius georadius = geohashGetAreasByRadiusWGS84(longitude, latitude, radius_mters);
-    /* Search the skip_list for all matching points */
-    std::list<DocidNode>* lptr = new (std::list<DocidNode>);
-    this->GetMembersOfAllNeighbors(georadius, longitude, latitude, radius_mters, lptr); 
-    // TODO a better implementation
-    if (lptr->size() > 0) {
-        return lptr;
+    if (caches_ && caches_->radius) {
+        std::shared_ptr<const GeoCacheEntry> entry = this->GetCachedCandidates(longitude, latitude, radius_mters);
+        if (entry) {
+            entry->candidates.Filter(longitude, latitude, radius_mters, group);
+            return;
+        }
+    }
+    GeoCandidates& candidates = ScratchCandidates();
+    this->GetCandidates(longitude, latitude, radius_mters, candidates, &group);
+    candidates.Filter(longitude, latitude, radius_mters, group);
+}
+
+//
+// covering of a query polygon, it depends on the polygon only, so it is
+// cached by the polygon id and stays valid across Add
+//
+struct GeoFenceCover {
+    GeoFenceCover(const std::vector<std::pair<double, double>>& points) : area(0, true, points) {}
+    void Cover(GeoHashBits hash, uint8_t max_step);
+
+    GeoArea area;
+    std::vector<GeoHashBits> interior;
+    std::vector<GeoHashBits> boundary;
+};
+
+void GeoFenceCover::Cover(GeoHashBits hash, uint8_t max_step) {
+    GeoHashArea rect;
+    geohashDecodeWGS84(hash, &rect);
+    GeoArea::Relation relation = area.Relate(rect);
+    if (relation == GeoArea::OUTSIDE) {
+        return;
+    } else if (relation == GeoArea::INSIDE) {
+        interior.push_back(hash);
+    } else if (hash.step >= max_step) {
+        boundary.push_back(hash);
     } else {
-        delete lptr;
+        for (uint64_t child = 0; child < 4; ++child) {
+            GeoHashBits child_hash = { (hash.bits << 2) | child, (uint8_t)(hash.step + 1) };
+            this->Cover(child_hash, max_step);
+        }
+    }
+}
+
+std::shared_ptr<const GeoFenceCover> GeoIndexer::GetFenceCover(const Term& term) {
+    std::vector<std::pair<double, double>> points;
+    term.GetFencePoints(points);
+    if (points.size() < 3) {
+        cLog(WARN, "[geo_indexer warning] polygon needs 3 points at least");
+        return NULL;
+    }
+    uint64_t id = term.fence_id();
+    std::shared_ptr<const GeoFenceCover> cover;
+    GeoCaches::FenceCache *cache = (id != 0 && caches_) ? caches_->fence.get() : NULL;
+    if (cache && cache->Get(id, &cover) && cover->area.points() == points) {
+        return cover;
+    }
+    std::shared_ptr<GeoFenceCover> fresh = std::make_shared<GeoFenceCover>(points);
+    std::vector<GeoHashBits> cells;
+    if (fresh->area.StartCells(cells)) {
+        uint8_t max_step = std::min(cells[0].step + GEO_FENCE_REFINE_LEVELS, GEO_STEP_MAX);
+        for (auto& hash : cells) {
+            fresh->Cover(hash, max_step);
+        }
+    }
+    cLog(DEBUG, "[geo_indexer] polygon covered, id=%lu, interior=%d, boundary=%d",
+            id, (int)fresh->interior.size(), (int)fresh->boundary.size());
+    if (cache) {
+        cache->Put(id, fresh);
+    }
+    return fresh;
+}
+
+void GeoIndexer::SearchFence(const Term& term, DocListGroup& group) {
+    std::shared_ptr<const GeoFenceCover> cover = this->GetFenceCover(term);
+    if (!cover) {
+        return;
+    }
+    GeoHashFix52Bits min, max;
+    for (auto& hash : cover->interior) {
+        scoresOfGeoHashBox(hash, &min, &max);
+        this->GetDocListsInRange(min, max, group);
+    }
+    GeoCandidates& candidates = ScratchCandidates();
+    for (auto& hash : cover->boundary) {
+        this->GetMembersOfGeoHashBox(hash, candidates);
+    }
+    candidates.Filter(cover->area, group);
+}
+
+void GeoIndexer::GetCandidates(double lon, double lat, double radius, GeoCandidates& candidates, DocListGroup* group) {
+    if (is_compiled_) {
+        GeoArea circle(0, true, lon, lat, radius);
+        std::vector<GeoHashBits> cells;
+        if (circle.StartCells(cells)) {
+            for (auto& hash : cells) {
+                this->CoverCircle(circle, hash, candidates, group);
+            }
+        }
+        return;
+    }
+    GeoHashRadius georadius = geohashGetAreasByRadiusWGS84(lon, lat, radius);
+    /* Search the skip_list for all matching points */
+    this->GetMembersOfAllNeighbors(georadius, candidates); 
+}
+
+GeoCaches::GeoCaches(size_t radius_capacity, size_t fence_capacity)
+    : radius(radius_capacity > 0 ? new RadiusCache(radius_capacity) : NULL),
+      fence(fence_capacity > 0 ? new FenceCache(fence_capacity) : NULL) {
+}
+
+void GeoIndexer::SetCaches(GeoCaches *caches, size_t partition) {
+    caches_ = caches;
+    partition_ = partition;
+}
+
+//
+// the entry of a key is built for the center of its location cell, with the
+// radius grown by the bucket and by the distance to the farthest cell corner,
+// so it covers every search falling into the key
+//
+std::shared_ptr<const GeoCacheEntry> GeoIndexer::GetCachedCandidates(double lon, double lat, double radius) {
+    GeoHashBits cell;
+    GeoHashFixedCoord coord;
+    double buckets = ceil(radius / GEO_CACHE_RADIUS_BUCKET);
+    if (buckets >= (1 << GEO_CACHE_BUCKET_BITS) || partition_ >= (1 << GEO_CACHE_PARTITION_BITS) ||
+            !geohashToFixed(lon, lat, &coord) || !geohashEncodeFixed(&coord, GEO_CACHE_STEP, &cell)) {
         return NULL;
     }
+    uint64_t key = (((cell.bits << GEO_CACHE_PARTITION_BITS) | partition_) << GEO_CACHE_BUCKET_BITS)
+                   | static_cast<uint64_t>(buckets);
+    std::shared_ptr<const GeoCacheEntry> entry;
+    if (caches_->radius->Get(key, &entry) && entry->generation == generation_) {
+        return entry;
+    }
+    GeoHashArea rect;
+    geohashDecodeWGS84(cell, &rect);
+    double center_lon = (rect.longitude.min + rect.longitude.max) / 2;
+    double center_lat = (rect.latitude.min + rect.latitude.max) / 2;
+    double reach = std::max(
+            geohashGetDistance(center_lon, center_lat, rect.longitude.max, rect.latitude.max),
+            geohashGetDistance(center_lon, center_lat, rect.longitude.max, rect.latitude.min));
+    std::shared_ptr<GeoCacheEntry> fresh = std::make_shared<GeoCacheEntry>();
+    fresh->generation = generation_;
+    this->GetCandidates(center_lon, center_lat, buckets * GEO_CACHE_RADIUS_BUCKET + reach, fresh->candidates, NULL);
+    caches_->radius->Put(key, fresh);
+    return fresh;
+}
+
+// the haversine of GeoCandidates::Within on the cells of each doc
+void GeoIndexer::GetDistances(const Term& term, const std::vector<int>& docids,
+        std::unordered_map<int, double>& distances) {
+    if (term.type() != ValueType::GEORANGE) {
+        return;
+    }
+    double half_angle = term.radius() / (2.0 * GEO_EARTH_RADIUS_IN_METERS);
+    double max_h = (half_angle < M_PI / 2) ? sin(half_angle) * sin(half_angle) : HUGE_VAL;
+    double lon1 = term.longitude() * GEO_D_R;
+    double lat1 = term.latitude() * GEO_D_R;
+    double cos_lat1 = cos(lat1);
+    for (int docid : docids) {
+        auto cells = doc_cells_.find(docid);
+        if (cells == doc_cells_.end()) {
+            continue;
+        }
+        for (const GeoNode *node : cells->second) {
+            double u = sin((node->lat_rad() - lat1) / 2);
+            double v = sin((node->lon_rad() - lon1) / 2);
+            double h = u * u + cos_lat1 * node->cos_lat() * v * v;
+            if (h > max_h) {
+                continue;
+            }
+            double distance = 2.0 * GEO_EARTH_RADIUS_IN_METERS * asin(sqrt(std::min(h, 1.0)));
+            auto iter = distances.find(docid);
+            if (iter == distances.end()) {
+                distances.insert(std::make_pair(docid, distance));
+            } else if (distance < iter->second) {
+                iter->second = distance;
+            }
+        }
+    }
+}
+
+// flatten skip list into a CompiledGeoCells snapshot, following searches use
+// the snapshot until the next Add
+void GeoIndexer::Compile() {
+    // cached candidates point into the old snapshot
+    ++generation_;
+    compiled_.Clear();
+    for (auto& node : inverted_lists_) {
+        compiled_.Append(node);
+    }
+    compiled_.Seal();
+    is_compiled_ = true;
+    cLog(INFO, "[geo_indexer] compiled, cells=%zu", compiled_.size());
+}
+
+void GeoIndexer::GetStats(IndexerStats& stats) const {
+    stats.keys += inverted_lists_.size();
+    for (auto& node : inverted_lists_) {
+        stats.AddList(node.list().length());
+        stats.bytes += sizeof(node) + SKIP_NODE_BYTES + node.list().length() * POSTING_NODE_BYTES;
+    }
+    stats.bytes += compiled_.bytes();
+    for (auto& p : doc_cells_) {
+        stats.bytes += sizeof(p) + p.second.capacity() * sizeof(const GeoNode*);
+    }
+}
+
+std::list<DocidNode>* GeoIndexer::GetPostingLists(const Term& term) {
+    DocListGroup group;
+    this->GetPostingLists(term, group);
+    return (group.size() == 1) ? group[0] : NULL;
 }
 
 } // namespace cloris
@@ -7,18 +7,38 @@
 #ifndef CLORIS_GEO_INDEXER_H_
 #define CLORIS_GEO_INDEXER_H_
 
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include "inverted_list.h"
 #include "internal/cloriskip/skip_list.h"
+#include "internal/lru_cache.h"
 #include "geohash_helper.h"
 #include "indexer.h"
 
+// cells filtered per chunk by the radius filter
+#define GEO_FILTER_CHUNK        256
+// a partially covered cell with no more points than this is scanned instead of split
+#define GEO_COVER_SCAN_CELLS    16
+// query cache quantization: geohash level of the location cell (about 38m x 19m)
+// and the radius bucket in meter. A key has 16 bits for the bucket and 8 for
+// the partition, larger radii and partitions are not cached
+#define GEO_CACHE_STEP          20
+#define GEO_CACHE_RADIUS_BUCKET 100
+#define GEO_CACHE_BUCKET_BITS   16
+#define GEO_CACHE_PARTITION_BITS 8
+// levels below the start level a query polygon is refined to
+#define GEO_FENCE_REFINE_LEVELS 6
+
 namespace cloris {
 
+class GeoArea;
+struct GeoFenceCover;
+
 class GeoNode {
 public:
-    GeoNode(GeoHashFix52Bits geo_bits) : geo_bits_(geo_bits) {}
+    GeoNode(GeoHashFix52Bits geo_bits) : geo_bits_(geo_bits), lon_rad_(0), lat_rad_(0), cos_lat_(1) {}
     ~GeoNode() {}
     bool operator < (const GeoNode& other) const {
         return (this->geo_bits_ < other.geo_bits());
@@ -26,31 +46,183 @@ public:
     bool operator >= (const GeoNode& other) const {
         return !(operator < (other));
     }
-    void Add(bool is_belong_to, int docid) { return list_.Add(is_belong_to, docid); }
+    // several points of one doc may fall in the same cell
+    void Add(bool is_belong_to, int docid) { list_.AddUnique(is_belong_to, docid); }
+    InvertedList& list() { return list_; }
     const InvertedList& list() const { return list_; }
     GeoHashFix52Bits geo_bits() const { return geo_bits_; }
+    // decode the cell center once when the node is created, searches only
+    // read the cached values
+    bool Locate();
+    double lon_rad() const { return lon_rad_; }
+    double lat_rad() const { return lat_rad_; }
+    double cos_lat() const { return cos_lat_; }
 private:
     GeoNode() = delete;
     GeoHashFix52Bits geo_bits_; 
+    double lon_rad_;
+    double lat_rad_;
+    double cos_lat_;
     InvertedList list_;
 };
 
+//
+// nodes hit by one radius search. Cells of the compiled snapshot are kept as
+// ranges of its coordinate arrays, skip list nodes are gathered into arrays
+// of their own, so the distance filter always runs over contiguous doubles.
+// Clear keeps the buffers, searches reuse one per thread
+//
+class GeoCandidates {
+public:
+    GeoCandidates() : size_(0) {}
+    ~GeoCandidates() {}
+    void Clear();
+    void Append(GeoNode& node);
+    // 'size' cells of a snapshot, the arrays must outlive the candidates
+    void Append(const double *lon_rads, const double *lat_rads, const double *cos_lats,
+            GeoNode *const *nodes, size_t size);
+    // push the lists of nodes within 'radius' meters of (lon, lat) to 'group'
+    void Filter(double lon, double lat, double radius, DocListGroup& group) const;
+    // push the lists of nodes inside 'area' to 'group'
+    void Filter(const GeoArea& area, DocListGroup& group) const;
+    size_t size() const { return size_; }
+private:
+    struct Block {
+        const double *lon_rads;
+        const double *lat_rads;
+        const double *cos_lats;
+        GeoNode *const *nodes;
+        size_t size;
+    };
+    // 'visit' every node within 'radius' with its haversine value
+    template <typename Visit>
+    void Within(double lon, double lat, double radius, Visit visit) const;
+    // the snapshot ranges followed by the gathered nodes
+    template <typename Visit>
+    void ForEachBlock(Visit visit) const;
+
+    std::vector<Block> blocks_;
+    std::vector<double> lon_rads_;
+    std::vector<double> lat_rads_;
+    std::vector<double> cos_lats_;
+    std::vector<GeoNode*> nodes_;
+    size_t size_;
+};
+
+//
+// An immutable snapshot of the geo skip list for read-mostly data: cell keys
+// are kept sorted in one contiguous array with their coordinates in parallel
+// arrays. A directory on the top bits of the key narrows every lookup to a
+// small bucket, so a geohash box is two short binary searches and a linear
+// scan. Doc lists stay in the skip list nodes, the snapshot is dropped on Add
+//
+class CompiledGeoCells {
+public:
+    CompiledGeoCells() : prefix_bits_(0) {}
+    ~CompiledGeoCells() {}
+    void Clear();
+    // cells must be appended in ascending key order
+    void Append(GeoNode& node);
+    void Seal();
+    // append cells with key in [min, max) to 'candidates'
+    void GetCellsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, GeoCandidates& candidates) const;
+    // index of the first cell whose key >= 'key', the number of cells of any
+    // geohash box is the distance between the bounds of its key range
+    size_t LowerBound(GeoHashFix52Bits key) const;
+    void AppendCandidates(size_t begin, size_t end, GeoCandidates& candidates) const;
+    void AppendDocLists(size_t begin, size_t end, DocListGroup& group) const;
+    size_t size() const { return keys_.size(); }
+    size_t bytes() const {
+        return keys_.capacity() * sizeof(GeoHashFix52Bits) + nodes_.capacity() * sizeof(GeoNode*)
+               + (lon_rads_.capacity() + lat_rads_.capacity() + cos_lats_.capacity()) * sizeof(double)
+               + directory_.capacity() * sizeof(uint32_t);
+    }
+private:
+
+    std::vector<GeoHashFix52Bits> keys_;
+    std::vector<double> lon_rads_;
+    std::vector<double> lat_rads_;
+    std::vector<double> cos_lats_;
+    std::vector<GeoNode*> nodes_;
+    std::vector<uint32_t> directory_; // key prefix ==> first cell with that prefix or above
+    int prefix_bits_;
+};
+
+struct GeoCacheKeyHash {
+    size_t operator()(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ULL) >> 32; }
+};
+
+struct GeoCacheEntry {
+    uint64_t generation; // of the indexer when built
+    GeoCandidates candidates;
+};
+
+//
+// caches of one geo field, owned by the InvertedIndex and shared by the
+// indexers of the field in all partitions, so there is one capacity per
+// field. Radius entries hold the cells of one partition and are keyed by it
+// too, polygon coverings depend on the polygon only and serve all partitions
+//
+struct GeoCaches {
+    typedef ShardedLRUCache<uint64_t, std::shared_ptr<const GeoCacheEntry>, GeoCacheKeyHash> RadiusCache;
+    typedef ShardedLRUCache<uint64_t, std::shared_ptr<const GeoFenceCover>, GeoCacheKeyHash> FenceCache;
+    // 0 disables a cache
+    GeoCaches(size_t radius_capacity, size_t fence_capacity);
+    std::unique_ptr<RadiusCache> radius;
+    std::unique_ptr<FenceCache> fence; // polygon id ==> covering
+};
+
+//
+// a radius search hits the doc lists of many geohash nodes, they are handed to
+// the scorer as a DocListGroup and merged lazily in docid order, no doc list
+// is copied per query
+//
 class GeoIndexer : public Indexer {
-    static void ReclaimPostingList(std::list<DocidNode>* lptr);
 public:
     GeoIndexer(const std::string& name);
     ~GeoIndexer();
     virtual bool ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value); 
     virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental);
+    // a radius may hit several nodes, use the DocListGroup version
     virtual std::list<DocidNode>* GetPostingLists(const Term& term);
-    void GetGeoPointsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, 
-            double lon, double lat, double radius, std::list<DocidNode> *lptr);
+    virtual void GetPostingLists(const Term& term, DocListGroup& group);
+    virtual void Compile();
+    // looked up by docid, so the cost follows 'docids' and not the points
+    // around. The nearest point counts for a doc with several points
+    virtual void GetDistances(const Term& term, const std::vector<int>& docids,
+            std::unordered_map<int, double>& distances);
+    virtual const char* index_type() const { return "geo"; }
+    // caches are not counted
+    virtual void GetStats(IndexerStats& stats) const;
+    // cache the candidates of radius searches in 'caches', keyed on the
+    // quantized location and radius and on 'partition'. Entries hold a
+    // superset of the nodes any search of the key may hit, the exact filter
+    // still runs per search, so results are exact. Polygon coverings go to
+    // its fence cache. 'caches' must outlive the indexer
+    void SetCaches(GeoCaches *caches, size_t partition);
+    void GetGeoPointsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, GeoCandidates& candidates);
+    void GetDocListsInRange(GeoHashFix52Bits min, GeoHashFix52Bits max, DocListGroup& group);
 private:
     bool Add(const Term& term, bool is_belong_to, int docid); 
-    void GetMembersOfGeoHashBox(GeoHashBits hash, std::list<DocidNode> *lptr, double lon, double lat, double radius);
-    void GetMembersOfAllNeighbors(const GeoHashRadius& n, double lon, double lat, double radius, std::list<DocidNode>* lptr); 
+    void GetMembersOfGeoHashBox(GeoHashBits hash, GeoCandidates& candidates);
+    void GetMembersOfAllNeighbors(const GeoHashRadius& n, GeoCandidates& candidates); 
+    // 'group' takes the nodes surely inside the circle, they go to 'candidates' if it is NULL
+    void GetCandidates(double lon, double lat, double radius, GeoCandidates& candidates, DocListGroup* group);
+    void CoverCircle(const GeoArea& circle, GeoHashBits hash, GeoCandidates& candidates, DocListGroup* group);
+    // interior cells of the covering are taken as a whole, only points in
+    // boundary cells are tested against the polygon
+    void SearchFence(const Term& term, DocListGroup& group);
+    std::shared_ptr<const GeoFenceCover> GetFenceCover(const Term& term);
+    std::shared_ptr<const GeoCacheEntry> GetCachedCandidates(double lon, double lat, double radius);
     GeoIndexer() = delete;
     goodliffe::skip_list<GeoNode> inverted_lists_;
+    CompiledGeoCells compiled_;
+    bool is_compiled_;
+    GeoCaches *caches_; // NULL if no cache, not owned
+    uint64_t partition_;
+    uint64_t generation_; // bumped by every Add and Compile, older cache entries are stale
+    // docid ==> cells of its belong-to points, nodes are never removed
+    std::unordered_map<int, std::vector<const GeoNode*>> doc_cells_;
 };
 
 } // namespace cloris
@@ -29,6 +29,9 @@
  * THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "geohash.h"
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 /**
  * Hashing works like this:
@@ -50,6 +53,10 @@
  * From:  https://graphics.stanford.edu/~seander/bithacks.html#InterleaveBMN
  */
 static inline uint64_t interleave64(uint32_t xlo, uint32_t ylo) {
+#if defined(__BMI2__)
+    /* one bit deposit per coordinate, built with -mbmi2 (cmake -DWITH_BMI2=ON) */
+    return _pdep_u64(xlo, 0x5555555555555555ULL) | _pdep_u64(ylo, 0xAAAAAAAAAAAAAAAAULL);
+#else
     static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
                                  0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
                                  0x0000FFFF0000FFFFULL};
@@ -74,12 +81,17 @@ static inline uint64_t interleave64(uint32_t xlo, uint32_t ylo) {
     y = (y | (y << S[0])) & B[0];
 
     return x | (y << 1);
+#endif
 }
 
 /* reverse the interleave process
  * derived from http://stackoverflow.com/questions/4909263
  */
 static inline uint64_t deinterleave64(uint64_t interleaved) {
+#if defined(__BMI2__)
+    return _pext_u64(interleaved, 0x5555555555555555ULL) |
+           (_pext_u64(interleaved, 0xAAAAAAAAAAAAAAAAULL) << 32);
+#else
     static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
                                  0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
                                  0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
@@ -107,6 +119,7 @@ static inline uint64_t deinterleave64(uint64_t interleaved) {
     y = (y | (y >> S[5])) & B[5];
 
     return x | (y << 32);
+#endif
 }
 
 void geohashGetCoordRange(GeoHashRange *long_range, GeoHashRange *lat_range) {
@@ -162,6 +175,31 @@ int geohashEncodeWGS84(double longitude, double latitude, uint8_t step,
     return geohashEncodeType(longitude, latitude, step, hash);
 }
 
+/* Convert the coordinates to fixed point once, the geohash of any step is
+ * then taken from the integers without touching doubles again. The result
+ * is the same as geohashEncodeWGS84(): scaling by a power of two is exact,
+ * so dropping low bits equals truncating at the smaller step. */
+int geohashToFixed(double longitude, double latitude, GeoHashFixedCoord *coord) {
+    if (coord == NULL ||
+        longitude > GEO_LONG_MAX || longitude < GEO_LONG_MIN ||
+        latitude > GEO_LAT_MAX || latitude < GEO_LAT_MIN) return 0;
+
+    double lat_offset = (latitude - GEO_LAT_MIN) / (GEO_LAT_MAX - GEO_LAT_MIN);
+    double long_offset = (longitude - GEO_LONG_MIN) / (double)(GEO_LONG_MAX - GEO_LONG_MIN);
+    coord->lat = (uint32_t)(lat_offset * (1 << GEO_STEP_MAX));
+    coord->lon = (uint32_t)(long_offset * (1 << GEO_STEP_MAX));
+    return 1;
+}
+
+int geohashEncodeFixed(const GeoHashFixedCoord *coord, uint8_t step, GeoHashBits *hash) {
+    if (hash == NULL || step > GEO_STEP_MAX || step == 0) return 0;
+
+    hash->step = step;
+    hash->bits = interleave64(coord->lat >> (GEO_STEP_MAX - step),
+                              coord->lon >> (GEO_STEP_MAX - step));
+    return 1;
+}
+
 int geohashDecode(const GeoHashRange long_range, const GeoHashRange lat_range,
                    const GeoHashBits hash, GeoHashArea *area) {
     if (HASHISZERO(hash) || NULL == area || RANGEISZERO(lat_range) ||
@@ -68,6 +68,12 @@ typedef struct {
     uint8_t step;
 } GeoHashBits;
 
+/* coordinates as offsets in the WGS84 range, GEO_STEP_MAX bits each */
+typedef struct {
+    uint32_t lon;
+    uint32_t lat;
+} GeoHashFixedCoord;
+
 typedef struct {
     double min;
     double max;
@@ -102,6 +108,8 @@ int geohashEncodeType(double longitude, double latitude,
                       uint8_t step, GeoHashBits *hash);
 int geohashEncodeWGS84(double longitude, double latitude, uint8_t step,
                        GeoHashBits *hash);
+int geohashToFixed(double longitude, double latitude, GeoHashFixedCoord *coord);
+int geohashEncodeFixed(const GeoHashFixedCoord *coord, uint8_t step, GeoHashBits *hash);
 int geohashDecode(const GeoHashRange long_range, const GeoHashRange lat_range,
                   const GeoHashBits hash, GeoHashArea *area);
 int geohashDecodeType(const GeoHashBits hash, GeoHashArea *area);
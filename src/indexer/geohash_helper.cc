@@ -38,6 +38,7 @@
 #include "geohash_helper.h"
 // #include "debugmacro.h"
 #include <math.h>
+#include <string.h>
 
 #define D_R (M_PI / 180.0)
 #define R_MAJOR 6378137.0
@@ -119,6 +120,7 @@ GeoHashRadius geohashGetAreasByRadius(double longitude, double latitude, double
     GeoHashBits hash;
     GeoHashNeighbors neighbors;
     GeoHashArea area;
+    GeoHashFixedCoord coord;
     double min_lon, max_lon, min_lat, max_lat;
     double bounds[4];
     int steps;
@@ -132,7 +134,12 @@ GeoHashRadius geohashGetAreasByRadius(double longitude, double latitude, double
     steps = geohashEstimateStepsByRadius(radius_meters,latitude);
 
     geohashGetCoordRange(&long_range,&lat_range);
-    geohashEncode(&long_range,&lat_range,longitude,latitude,steps,&hash);
+    /* both candidate steps are cut from the same fixed point coordinates */
+    if (!geohashToFixed(longitude,latitude,&coord)) {
+        memset(&radius,0,sizeof(radius));
+        return radius;
+    }
+    geohashEncodeFixed(&coord,steps,&hash);
     geohashNeighbors(&hash,&neighbors);
     geohashDecode(long_range,lat_range,hash,&area);
 
@@ -162,7 +169,7 @@ GeoHashRadius geohashGetAreasByRadius(double longitude, double latitude, double
 
     if (steps > 1 && decrease_step) {
         steps--;
-        geohashEncode(&long_range,&lat_range,longitude,latitude,steps,&hash);
+        geohashEncodeFixed(&coord,steps,&hash);
         geohashNeighbors(&hash,&neighbors);
         geohashDecode(long_range,lat_range,hash,&area);
     }
@@ -8,7 +8,9 @@
 #define CLORIS_INDEXER_H_
 
 #include <list>
+#include <unordered_map>
 #include "inverted_index.pb.h"
+#include "internal/metrics.h"
 #include "posting_list.h"
 #include "term.h"
 
@@ -21,6 +23,26 @@ public:
     virtual bool ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value) = 0; 
     virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental) = 0;
     virtual std::list<DocidNode>* GetPostingLists(const Term& term) = 0;
+    // a term may hit more than one list (e.g. range search), override this
+    // to hand them all to the scorer, which merges them lazily
+    virtual void GetPostingLists(const Term& term, DocListGroup& group) {
+        std::list<DocidNode>* doc_list = GetPostingLists(term);
+        if (doc_list) {
+            group.push_back(doc_list);
+        }
+    }
+    // build read-only structures for read-mostly data, optional
+    virtual void Compile() {}
+    // merge redundant internal nodes, returns how many were removed
+    virtual size_t Compact() { return 0; }
+    // distances in meter from a geo term to those of 'docids' it hits, for
+    // indexers of locations
+    virtual void GetDistances(const Term& term, const std::vector<int>& docids,
+            std::unordered_map<int, double>& distances) {}
+    // index_type of the schema this indexer serves, e.g. "simple"
+    virtual const char* index_type() const = 0;
+    // add the sizes of this indexer to 'stats', walks the whole index
+    virtual void GetStats(IndexerStats& stats) const = 0;
     const ReclaimHandler& reclaim_handler() const { return reclaim_handler_; }
 protected:
     std::string name_;
@@ -4,15 +4,21 @@
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <algorithm>
+#include "internal/log.h"
 #include "internal/singleton.h"
 #include "simple_indexer.h"
 #include "interval_indexer.h"
+#include "segment_tree_indexer.h"
 #include "geo_indexer.h"
+#include "geo_area_indexer.h"
 #include "indexer_factory.h"
 
 #define INDEX_TYPE_SIMPLE       "simple"
 #define INDEX_TYPE_INTERVAL     "interval"
 #define INDEX_TYPE_GEO          "geo"
+#define INDEX_TYPE_SEGMENT_TREE "segment_tree"
+#define INDEX_TYPE_GEO_AREA     "geo_area"
 
 #define KEY_TYPE_INT32          "int32"
 #define KEY_TYPE_DOUBLE         "double"
@@ -24,6 +30,32 @@ IndexerFactory* IndexerFactory::instance() noexcept {
     return Singleton<IndexerFactory>::instance();
 }
 
+Indexer* IndexerFactory::CreateIndexer(const IndexSchema_Term& term, GeoCaches *geo_caches, size_t partition) {
+    // int32 interval with a declared small domain, resolved here once so that
+    // the search path has neither a type switch nor a domain check to make
+    if (term.index_type() == INDEX_TYPE_INTERVAL && term.key_type() == KEY_TYPE_INT32 
+            && term.has_min_value() && term.has_max_value()) {
+        IntervalIndexer<int32_t> *indexer = new IntervalIndexer<int32_t>(term.name());
+        if (!indexer->compiled_intervals().SetDomain(term.min_value(), term.max_value())) {
+            cLog(WARN, "[indexer_factory] domain of %s is too large or invalid, dense table disabled", term.name().c_str());
+        }
+        return indexer;
+    }
+    if (term.index_type() == INDEX_TYPE_GEO && geo_caches) {
+        GeoIndexer *indexer = new GeoIndexer(term.name());
+        indexer->SetCaches(geo_caches, partition);
+        return indexer;
+    }
+    return this->CreateIndexer(term.name(), term.key_type(), term.index_type());
+}
+
+std::shared_ptr<GeoCaches> IndexerFactory::CreateGeoCaches(const IndexSchema_Term& term) {
+    if (term.index_type() != INDEX_TYPE_GEO || (term.cache_size() <= 0 && term.fence_cache_size() <= 0)) {
+        return NULL;
+    }
+    return std::make_shared<GeoCaches>(std::max(term.cache_size(), 0), std::max(term.fence_cache_size(), 0));
+}
+
 Indexer* IndexerFactory::CreateIndexer(const std::string& name, const std::string& key_type, const std::string& index_type) {
     if (index_type == INDEX_TYPE_SIMPLE) {
         if (key_type == KEY_TYPE_INT32) {
@@ -43,8 +75,20 @@ Indexer* IndexerFactory::CreateIndexer(const std::string& name, const std::strin
         } else {
             return NULL;
         }
+    } else if (index_type == INDEX_TYPE_SEGMENT_TREE) {
+        if (key_type == KEY_TYPE_INT32) {
+            return new SegmentTreeIndexer<int32_t>(name);
+        } else if (key_type == KEY_TYPE_DOUBLE) {
+            return new SegmentTreeIndexer<double>(name);
+        } else if (key_type == KEY_TYPE_STRING) {
+            return new SegmentTreeIndexer<std::string>(name);
+        } else {
+            return NULL;
+        }
     } else if (index_type == INDEX_TYPE_GEO) {
         return new GeoIndexer(name);
+    } else if (index_type == INDEX_TYPE_GEO_AREA) {
+        return new GeoAreaIndexer(name);
     } else {
         return NULL;
     }
@@ -7,11 +7,14 @@
 #ifndef CLORIS_INDEXER_FACTORY_H_
 #define CLORIS_INDEXER_FACTORY_H_
 
+#include <memory>
 #include <string>
+#include "index_schema.pb.h"
 
 namespace cloris {
 
 class Indexer;
+struct GeoCaches;
 
 class IndexerFactory {
 public:
@@ -19,6 +22,12 @@ public:
 
     IndexerFactory() {}
     ~IndexerFactory() {}
+    // 'geo_caches' are set on a geo indexer of partition 'partition', see
+    // GeoIndexer::SetCaches
+    Indexer* CreateIndexer(const IndexSchema_Term& term, GeoCaches *geo_caches = NULL, size_t partition = 0);
+    // caches of a geo term, shared by its indexers in all partitions. NULL if
+    // the term is not geo or asks for none
+    std::shared_ptr<GeoCaches> CreateGeoCaches(const IndexSchema_Term& term);
     Indexer* CreateIndexer(const std::string& name, const std::string& key_type, const std::string& value_type);
 };
 
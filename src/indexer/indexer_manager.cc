@@ -4,28 +4,31 @@
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <algorithm>
+#include <functional>
 #include "internal/log.h"
 #include "indexer_factory.h"
 #include "indexer_manager.h"
 
 namespace cloris {
 
-IndexerManager::IndexerManager(size_t conj) : conjunctions_(conj) {
+IndexerManager::IndexerManager(size_t conj) : conjunctions_(conj), metrics_(NULL) {
 }
 
 IndexerManager::~IndexerManager() {
 }
 
-bool IndexerManager::DeclareTerm(const IndexSchema_Term& term) {
+bool IndexerManager::DeclareTerm(const IndexSchema_Term& term, GeoCaches *geo_caches) {
     if (indexer_table_.find(term.name()) != indexer_table_.end()) {
         return true;
     }
-    Indexer* indexer = IndexerFactory::instance()->CreateIndexer(term.name(), term.key_type(), term.index_type());
+    Indexer* indexer = IndexerFactory::instance()->CreateIndexer(term, geo_caches, conjunctions_);
     if (!indexer) {
         cLog(ERROR, "unsupported indexer type");
         return false;
     }
     indexer_table_.insert(std::pair<std::string, Indexer*>(term.name(), indexer));
+    field_ids_.insert(std::make_pair(term.name(), static_cast<int>(field_ids_.size())));
     return true;
 }
 
@@ -34,8 +37,11 @@ bool IndexerManager::Add(const Conjunction& conjunction, int docid, bool is_incr
         cLog(ERROR, "unsupported term:%s", conjunction.name().c_str());
         return false;
     } else {
-        cLog(INFO, "add term to indexer[%s], conjunctions=%d", conjunction.name().c_str(), conjunctions_);
+        cLog(DEBUG, "add term to indexer[%s], conjunctions=%zu", conjunction.name().c_str(), conjunctions_);
         bool is_belong_to = !conjunction.has_bt() || conjunction.bt();
+        if (is_belong_to && conjunction.has_weight()) {
+            weights_.Set(docid, field_ids_[conjunction.name()], conjunction.weight());
+        }
         return indexer_table_[conjunction.name()]->Add(conjunction.value(), is_belong_to, docid, is_incremental);
     }
 }
@@ -46,23 +52,43 @@ bool IndexerManager::Add(const Disjunction& disjunction, int docid, bool is_incr
     }
     // special for Zero-index
     if (conjunctions_ == 0) {
-        cLog(DEBUG, "add term to ZERO indexer[docid=%d], conjunction=%d", docid, conjunctions_); 
+        cLog(DEBUG, "add term to ZERO indexer[docid=%d], conjunction=%zu", docid, conjunctions_); 
         zlist_.Add(true, docid);
     }
     return true;
 }
 
 // 
-void IndexerManager::GetPostingLists(const Query& query, ConjunctionScorer& scorer) {
+void IndexerManager::GetPostingLists(const Query& query, ConjunctionScorer& scorer, QueryTrace *trace,
+        bool weighted) {
     for (auto& term : query) {
         if (indexer_table_.find(term.name()) != indexer_table_.end()) {
             cLog(DEBUG, "term ==> %s", term.print().c_str());
-            std::list<DocidNode>* doc_list = indexer_table_[term.name()]->GetPostingLists(term);
-            if (doc_list) {
-                scorer.AddPostingList(doc_list, indexer_table_[term.name()]->reclaim_handler());
-                cLog(INFO, "GetPostingLists, [conjs=%d, term:%s, found", conjunctions_, term.print().c_str());
+            Indexer* indexer = indexer_table_[term.name()];
+            DocListGroup group;
+            {
+                bool is_geo = (term.type() == ValueType::GEORANGE || term.type() == ValueType::GEOFENCE);
+                TraceTimer timer(trace, is_geo ? TS_GEO_EXPAND : TS_POSTING_FETCH);
+                LatencyHistogram *latency = metrics_ ? metrics_->fetch_latency(term.name()) : NULL;
+                uint64_t start = latency ? Metrics::NowNanos() : 0;
+                indexer->GetPostingLists(term, group);
+                if (latency) {
+                    latency->Record(Metrics::NowNanos() - start);
+                }
+            }
+            if (group.size() == 1) {
+                scorer.AddPostingList(group[0], indexer->reclaim_handler());
+                cLog(DEBUG, "GetPostingLists, [conjs=%zu, term:%s, found", conjunctions_, term.print().c_str());
+            } else if (group.size() > 1) {
+                scorer.AddPostingList(group);
+                cLog(DEBUG, "GetPostingLists, [conjs=%zu, term:%s, found %zu lists", conjunctions_, term.print().c_str(), group.size());
             } else {
-                cLog(INFO, "GetPostingLists, [conjs=%d, term:%s, NOT found", conjunctions_, term.print().c_str());
+                cLog(DEBUG, "GetPostingLists, [conjs=%zu, term:%s, NOT found", conjunctions_, term.print().c_str());
+                continue;
+            }
+            if (weighted) {
+                int field = field_ids_[term.name()];
+                scorer.SetScoreInfo(field, term.weight(), weights_.max(field) * std::max(term.weight(), 0.0));
             }
         }
     }
@@ -72,12 +98,117 @@ void IndexerManager::GetPostingLists(const Query& query, ConjunctionScorer& scor
     }
 }
 
+void IndexerManager::GetDistances(const Term& term, const std::vector<int>& docids,
+        std::unordered_map<int, double>& distances) {
+    auto iter = indexer_table_.find(term.name());
+    if (iter != indexer_table_.end()) {
+        iter->second->GetDistances(term, docids, distances);
+    }
+}
+
+void IndexerManager::Compile() {
+    for (auto& p : indexer_table_) {
+        p.second->Compile();
+    }
+}
+
+size_t IndexerManager::Compact() {
+    size_t merged = 0;
+    for (auto& p : indexer_table_) {
+        merged += p.second->Compact();
+    }
+    return merged;
+}
+
+void IndexerManager::GetStats(std::unordered_map<std::string, IndexerStats>& stats) const {
+    for (auto& p : indexer_table_) {
+        IndexerStats& s = stats[p.first];
+        s.name = p.first;
+        s.index_type = p.second->index_type();
+        p.second->GetStats(s);
+    }
+}
+
 // implementation of <<indexing boolean expression>> conjunction algorithm 
-std::vector<int> IndexerManager::Search(const Query& query, int limit) {
+std::vector<int> IndexerManager::Search(const Query& query, int limit, QueryTrace *trace) {
     ConjunctionScorer scorer;
-    this->GetPostingLists(query, scorer);
-    return scorer.GetMatchedDocid(this->conjunctions_);
+    if (!trace) {
+        this->GetPostingLists(query, scorer);
+        return scorer.GetMatchedDocid(this->conjunctions_);
+    }
+    uint64_t start = TraceTicks();
+    this->GetPostingLists(query, scorer, trace);
+    uint64_t fetched = TraceTicks();
+    std::vector<int> ret = scorer.GetMatchedDocid(this->conjunctions_, trace);
+    uint64_t scored = TraceTicks();
+    trace->AddTicks(TS_SCORER, scored - fetched);
+    PartitionTrace& partition = trace->AddPartition(this->conjunctions_);
+    partition.fetch_ticks = fetched - start;
+    partition.scorer_ticks = scored - fetched;
+    partition.lists = scorer.size();
+    partition.matched = ret.size();
+    return ret;
+}
+void IndexerManager::SearchTopK(const Query& query, const ScoreFunction& score, TopKHeap& heap, QueryTrace *trace) {
+    ConjunctionScorer scorer;
+    if (!trace) {
+        this->GetPostingLists(query, scorer);
+        scorer.GetTopK(this->conjunctions_, score, heap);
+        return;
+    }
+    uint64_t start = TraceTicks();
+    this->GetPostingLists(query, scorer, trace);
+    uint64_t fetched = TraceTicks();
+    size_t matched = 0;
+    ScoreFunction counted = [&score, &matched](int docid) { ++matched; return score(docid); };
+    scorer.GetTopK(this->conjunctions_, counted, heap, trace);
+    uint64_t scored = TraceTicks();
+    trace->AddTicks(TS_SCORER, scored - fetched);
+    PartitionTrace& partition = trace->AddPartition(this->conjunctions_);
+    partition.fetch_ticks = fetched - start;
+    partition.scorer_ticks = scored - fetched;
+    partition.lists = scorer.size();
+    partition.matched = matched;
+}
+
+void IndexerManager::SearchWeighted(const Query& query, TopKHeap& heap, QueryTrace *trace) {
+    ConjunctionScorer scorer;
+    if (!trace) {
+        this->GetPostingLists(query, scorer, NULL, true);
+        scorer.GetTopKWeighted(this->conjunctions_, weights_, heap);
+        return;
+    }
+    uint64_t start = TraceTicks();
+    this->GetPostingLists(query, scorer, trace, true);
+    uint64_t fetched = TraceTicks();
+    size_t matched = scorer.GetTopKWeighted(this->conjunctions_, weights_, heap, trace);
+    uint64_t scored = TraceTicks();
+    trace->AddTicks(TS_SCORER, scored - fetched);
+    PartitionTrace& partition = trace->AddPartition(this->conjunctions_);
+    partition.fetch_ticks = fetched - start;
+    partition.scorer_ticks = scored - fetched;
+    partition.lists = scorer.size();
+    partition.matched = matched;
 }
+
+// the k largest list bounds, as a doc of this partition is on k lists
+double IndexerManager::WeightBound(const Query& query) const {
+    std::vector<double> bounds;
+    for (auto& term : query) {
+        auto iter = field_ids_.find(term.name());
+        if (iter != field_ids_.end()) {
+            bounds.push_back(weights_.max(iter->second) * std::max(term.weight(), 0.0));
+        }
+    }
+    size_t k = std::min(conjunctions_, bounds.size());
+    std::partial_sort(bounds.begin(), bounds.begin() + k, bounds.end(), std::greater<double>());
+    double bound = 0.0;
+    for (size_t i = 0; i < k; ++i) {
+        bound += bounds[i];
+    }
+    return bound;
+}
+
 // std::unordered_map<std::string, Indexer*> indexer_table_;
 
 } // namespace cloris
@@ -16,20 +16,45 @@
 
 namespace cloris {
 
+struct GeoCaches;
+
 // 一个IndexerManager对象是一个conjunctions=N的集合 
 class IndexerManager {
 public:
     IndexerManager(size_t conj);
     ~IndexerManager();
-    bool DeclareTerm(const IndexSchema_Term& term);
+    // 'geo_caches' are shared by the indexers of the term in all partitions
+    bool DeclareTerm(const IndexSchema_Term& term, GeoCaches *geo_caches = NULL);
     bool Add(const Conjunction& conjunction, int docid, bool is_incremental);
     bool Add(const Disjunction& disjunction, int docid, bool is_incremental);
-    std::vector<int> Search(const Query& query, int limit);
-    void GetPostingLists(const Query& query, ConjunctionScorer& scorer);
+    // a partition is added to 'trace' if it is not NULL
+    std::vector<int> Search(const Query& query, int limit, QueryTrace *trace = NULL);
+    // push the matched docs into 'heap' by 'score', see InvertedIndex::SearchTopK
+    void SearchTopK(const Query& query, const ScoreFunction& score, TopKHeap& heap, QueryTrace *trace = NULL);
+    // push the matched docs into 'heap' by their weights, see
+    // InvertedIndex::SearchWeighted
+    void SearchWeighted(const Query& query, TopKHeap& heap, QueryTrace *trace = NULL);
+    // the most a doc of this partition can score in SearchWeighted
+    double WeightBound(const Query& query) const;
+    // 'weighted' tags every list with the weight info of its term for
+    // ConjunctionScorer::GetTopKWeighted
+    void GetPostingLists(const Query& query, ConjunctionScorer& scorer, QueryTrace *trace = NULL,
+            bool weighted = false);
+    void GetDistances(const Term& term, const std::vector<int>& docids, std::unordered_map<int, double>& distances);
+    void Compile();
+    size_t Compact();
+    // add the sizes of every indexer to the stats of its field
+    void GetStats(std::unordered_map<std::string, IndexerStats>& stats) const;
+    size_t zero_postings() const { return zlist_.length(); }
+    // posting list fetches are timed per field once set, NULL turns it off
+    void set_metrics(Metrics *metrics) { metrics_ = metrics; }
 private:
     InvertedList zlist_; // special Zero_list for Zero-index
     std::unordered_map<std::string, Indexer*> indexer_table_;
+    std::unordered_map<std::string, int> field_ids_; // in declaration order
+    ConjunctionWeights weights_;
     size_t conjunctions_;
+    Metrics *metrics_;
 };
 
 } // namespace cloris
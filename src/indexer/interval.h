@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <functional>
 #include <sstream>
+#include "term.h"
 
 // NEW ----
 #define INTERVAL_EMPTY          0x00000008
@@ -87,9 +88,9 @@ public:
     inline void Reset(const SelfType& other) { *this = other; } 
     inline void Reset(const T& left, const T& right, int32_t flag) {
         left_.value = left;
-        left_.flag = (flag & INTERVAL_CLOSE_MASK) ? INTERVAL_CLOSE : INTERVAL_LEFT_OPEN;
+        left_.flag = (flag & INTERVAL_LEFT_MASK) ? INTERVAL_CLOSE : INTERVAL_LEFT_OPEN;
         right_.value = right;
-        right_.flag = (flag & INTERVAL_CLOSE_MASK) ? INTERVAL_CLOSE : INTERVAL_RIGHT_OPEN;
+        right_.flag = (flag & INTERVAL_RIGHT_MASK) ? INTERVAL_CLOSE : INTERVAL_RIGHT_OPEN;
     }
     operator bool() const { return !(flag() & INTERVAL_EMPTY); }
 
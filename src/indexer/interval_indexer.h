@@ -9,7 +9,8 @@
 //
 // 2. 插入可能导致区间合并: e.g. Interval(10, 18] -- Docid(1, 2, 3, 4), 
 // Interval(18, 22] -- Docid(1, 2, 3) 在插入Interval(10, 22] -- Docid(4) 
-// 时应该合并区间为(10, 22] -- Docid(1, 2, 3, 4), 但目前没有合并区间
+// 时应该合并区间为(10, 22] -- Docid(1, 2, 3, 4). Add合并插入区间附近的相邻节点,
+// Compact对整个跳跃表做一次合并
 //
 // some tips-- 
 // 10-20 25-30
@@ -19,11 +20,11 @@
 #ifndef CLORIS_INTERVAL_INDEXER_H_
 #define CLORIS_INTERVAL_INDEXER_H_
 
-#include <stdexcept>  // std::logic_error
-#include <type_traits> // std::is_same
+#include <cstring> // memcpy
 #include <functional> // std::less
 #include "internal/cloriskip/skip_list.h"
 #include "internal/log.h"
+#include "compiled_interval.h"
 #include "interval.h"
 #include "indexer.h"
 
@@ -47,23 +48,43 @@ public:
     IntervalNode(const Term& term, ValueType type); 
     IntervalNode(const Interval<T>& interval, const InvertedList& vlist);
     IntervalNode(const Interval<T>& interval);
-    void Add(bool is_belong_to, int docid) { return list_.Add(is_belong_to, docid); }
+    void Add(bool is_belong_to, int docid) { 
+        signature_ += DocidNodeHash(docid, is_belong_to);
+        return list_.Add(is_belong_to, docid); 
+    }
     InvertedList& list() { return list_; }
+    const InvertedList& list() const { return list_; }
+    // always equals list().Hash()
+    size_t signature() const { return signature_; }
+    // 'next' starts right where this node ends and holds the same doc list
+    bool IsMergeable(const IntervalNode& next) const;
+    // extend this node to 'right', used after the mergeable next node is removed
+    void Extend(const BoundaryPoint<T>& right) { this->Reset(Interval<T, Comp>(this->left(), right)); }
 private:
     InvertedList list_;
+    size_t signature_;
 };
 
 template<typename T, typename Comp>
 IntervalNode<T, Comp>::IntervalNode(const Interval<T>& interval, const InvertedList& vlist) {
     this->Reset(interval);
     list_.Copy(vlist);
+    signature_ = list_.Hash();
 }
 
 template<typename T, typename Comp>
-IntervalNode<T, Comp>::IntervalNode(const Interval<T>& interval) {
+IntervalNode<T, Comp>::IntervalNode(const Interval<T>& interval) : signature_(0) {
     this->Reset(interval);
 }
 
+template<typename T, typename Comp>
+bool IntervalNode<T, Comp>::IsMergeable(const IntervalNode& next) const {
+    if (this->is_empty() || next.is_empty() || !(next.left() == this->right().GetInverted(Dir::RIGHT))) {
+        return false;
+    }
+    return (signature_ == next.signature()) && (list_ == next.list());
+}
+
 //
 // template specialization for support data type
 //
@@ -73,14 +94,19 @@ T convert(const void *p, size_t sz) {
     return T(static_cast<const char*>(p), sz);
 }
 
+// Term bytes are not aligned, memcpy compiles to a single load
 template<>
-int32_t convert(const void *p, size_t sz) {
-    return *reinterpret_cast<const int32_t*>(p);
+inline int32_t convert(const void *p, size_t sz) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
 template<>
-double convert(const void *p, size_t sz) {
-    return *reinterpret_cast<const double*>(p);
+inline double convert(const void *p, size_t sz) {
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
 // string
@@ -90,18 +116,24 @@ T convert(const void *p) {
 }
 
 template<>
-int32_t convert(const void *p) {
-    return *reinterpret_cast<const int32_t*>(p);
+inline int32_t convert(const void *p) {
+    return convert<int32_t>(p, sizeof(int32_t));
 }
 
 template<>
-double convert(const void *p) {
-    return *reinterpret_cast<const double*>(p);
+inline double convert(const void *p) {
+    return convert<double>(p, sizeof(double));
 }
 
+// value type of the interval terms an indexer of key type T accepts
+template<typename T> struct IntervalValueType;
+template<> struct IntervalValueType<int32_t>     { static const ValueType value = INT32_INTERVAL; };
+template<> struct IntervalValueType<double>      { static const ValueType value = DOUBLE_INTERVAL; };
+template<> struct IntervalValueType<std::string> { static const ValueType value = STRING_INTERVAL; };
+
 // special for string type
 template<typename T, typename Comp>
-IntervalNode<T, Comp>::IntervalNode(const Term& term, ValueType type) {
+IntervalNode<T, Comp>::IntervalNode(const Term& term, ValueType type) : signature_(0) {
     if (!(type & term.type() & BASIC_TYPE_MASK)) {
         this->set_empty();
         return;
@@ -131,26 +163,26 @@ public:
     bool Add(const Term& term, bool is_belong_to, int docid);
     virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental);
     virtual std::list<DocidNode>* GetPostingLists(const Term& term);
+    virtual void GetPostingLists(const Term& term, DocListGroup& group);
+    virtual void Compile();
+    virtual size_t Compact();
+    virtual const char* index_type() const { return "interval"; }
+    virtual void GetStats(IndexerStats& stats) const;
+    // e.g. the value domain of int32 keys, kept across Compile
+    CompiledIntervals<T>& compiled_intervals() { return compiled_; }
 private:
+    typedef typename goodliffe::skip_list<IntervalNode<T, Compare>>::iterator NodeIterator;
+    size_t Coalesce(NodeIterator iter, const Interval<T>& range);
     goodliffe::skip_list<IntervalNode<T, Compare>> inverted_lists_;
+    // read-only snapshot of 'inverted_lists_', invalidated by Add
+    CompiledIntervals<T> compiled_;
+    bool is_compiled_;
 };
 
 template<typename T, typename C>
-IntervalIndexer<T, C>::IntervalIndexer(const std::string& name) : Indexer(name) {
-    #define INT32_OFFSET        1
-    #define DOUBLE_OFFSET       2
-    #define STRING_OFFSET       3
-    int32_t flag(0x01);
-    flag <<= std::is_same<T, int32_t>() * INT32_OFFSET;
-    flag <<= std::is_same<T, double>() * DOUBLE_OFFSET;
-    flag <<= std::is_same<T, std::string>() * STRING_OFFSET;
-    flag |= INTERVAL_TYPE_MASK;
-
-    if (flag < MIN_INTERVAL_TYPE || flag > MAX_INTERVAL_TYPE) {
-        throw std::logic_error("unsupported interval indexer type");
-    } else {
-        type_ = static_cast<ValueType>(flag);
-    }
+IntervalIndexer<T, C>::IntervalIndexer(const std::string& name) : Indexer(name), is_compiled_(false) {
+    // unsupported T fails to compile here
+    type_ = IntervalValueType<T>::value;
 }
 
 template<typename T, typename C>
@@ -177,13 +209,16 @@ bool IntervalIndexer<T, C>::ParseTermsFromConjValue(std::vector<Term>& terms, co
     return true;
 }
 
-// TODO support range search like 18 <= age < 20, not only single value
+// point search, e.g. age = 18
 template<typename T, typename C>
 std::list<DocidNode>* IntervalIndexer<T, C>::GetPostingLists(const Term& term) {
     IntervalNode<T> search_node(term, type_);
     if (!search_node) {
         return NULL;
     }
+    if (is_compiled_) {
+        return compiled_.GetPostingList(search_node.left());
+    }
     // 得到实际是交集
     typename goodliffe::skip_list<IntervalNode<T, C>>::iterator iter = inverted_lists_.find(search_node);
     if (iter != inverted_lists_.end()) {
@@ -194,13 +229,40 @@ std::list<DocidNode>* IntervalIndexer<T, C>::GetPostingLists(const Term& term) {
     }
 }
 
+//
+// range search like 18 <= age < 20, a point term is treated as [X, X].
+// nodes in skip list are disjoint and sorted, so all nodes overlapping the
+// search interval are adjacent, their lists are merged lazily by the scorer
+//
+template<typename T, typename C>
+void IntervalIndexer<T, C>::GetPostingLists(const Term& term, DocListGroup& group) {
+    IntervalNode<T> search_node(term, type_);
+    if (!search_node) {
+        return;
+    }
+    if (is_compiled_) {
+        compiled_.GetPostingLists(search_node.left(), search_node.right(), group);
+        return;
+    }
+    typename goodliffe::skip_list<IntervalNode<T, C>>::iterator iter = inverted_lists_.find_first(search_node);
+    for (; iter != inverted_lists_.end() && !(search_node < *iter); ++iter) {
+        cLog(DEBUG, "[interval_indexer] range search %s hit node %s", search_node.print().c_str(), iter->print().c_str());
+        group.push_back(&(iter->list().mutable_doc_list()));
+    }
+}
+
 //
 // ParseTermsFromConjValue 已经保证term的合法性(即term的类型和T一致)
 //
 template<typename T, typename C>
 bool IntervalIndexer<T, C>::Add(const Term& term, bool is_belong_to, int docid) {
     IntervalNode<T> search_node(term, type_);
-    cLog(INFO, "[interval_indexer] try add node %s, term: %s", search_node.print().c_str(), term.print().c_str());
+    cLog(DEBUG, "[interval_indexer] try add node %s, term: %s", search_node.print().c_str(), term.print().c_str());
+    if (is_compiled_) {
+        compiled_.Clear();
+        is_compiled_ = false;
+    }
+    Interval<T> range(search_node);
 
     while (search_node) {
         // try to find the the first node whose intersection with term is not empty 
@@ -250,9 +312,79 @@ bool IntervalIndexer<T, C>::Add(const Term& term, bool is_belong_to, int docid)
             search_node = xright;
         }
     }
+    // only nodes inside 'range' and their two neighbors can become mergeable
+    if (range) {
+        NodeIterator iter = inverted_lists_.find_first(IntervalNode<T, C>(range));
+        if (iter != inverted_lists_.end() && iter != inverted_lists_.begin()) {
+            --iter;
+        }
+        this->Coalesce(iter, range);
+    }
     return true;
 }
 
+//
+// merge adjacent nodes with identical doc lists, starting from 'iter' and
+// stopping after the first node beyond 'range' (an empty range means no limit)
+//
+template<typename T, typename C>
+size_t IntervalIndexer<T, C>::Coalesce(NodeIterator iter, const Interval<T>& range) {
+    size_t merged = 0;
+    while (iter != inverted_lists_.end()) {
+        NodeIterator next = iter;
+        ++next;
+        while (next != inverted_lists_.end() && iter->IsMergeable(*next)) {
+            cLog(DEBUG, "[interval_indexer] merge node %s and %s", iter->print().c_str(), next->print().c_str());
+            // skip list locates the node to erase by value, so 'next' must be
+            // removed before 'iter' grows to overlap it
+            BoundaryPoint<T> right = next->right();
+            next = inverted_lists_.erase(next);
+            iter->Extend(right);
+            ++merged;
+        }
+        if (range && range.right() < iter->left()) {
+            break;
+        }
+        iter = next;
+    }
+    return merged;
+}
+
+// full pass over the skip list, returns the number of merged nodes
+template<typename T, typename C>
+size_t IntervalIndexer<T, C>::Compact() {
+    Interval<T> unlimited;
+    unlimited.set_empty();
+    size_t merged = this->Coalesce(inverted_lists_.begin(), unlimited);
+    cLog(INFO, "[interval_indexer] compact done, merged=%zu, nodes=%zu", merged, inverted_lists_.size());
+    return merged;
+}
+
+// flatten skip list into a CompiledIntervals snapshot, following searches use
+// the snapshot until the next Add
+template<typename T, typename C>
+void IntervalIndexer<T, C>::Compile() {
+    compiled_.Clear();
+    for (auto& node : inverted_lists_) {
+        compiled_.Append(node.left(), node.right(), node.list());
+    }
+    compiled_.Seal();
+    is_compiled_ = true;
+    cLog(INFO, "[interval_indexer] compiled, segments=%zu, blocks=%zu", compiled_.segment_size(), compiled_.block_size());
+}
+
+template<typename T, typename C>
+void IntervalIndexer<T, C>::GetStats(IndexerStats& stats) const {
+    stats.keys += inverted_lists_.size();
+    for (auto& node : inverted_lists_) {
+        if (node.list().length() > 0) {
+            stats.AddList(node.list().length());
+        }
+        stats.bytes += sizeof(node) + SKIP_NODE_BYTES + node.list().length() * POSTING_NODE_BYTES;
+    }
+    stats.bytes += compiled_.bytes();
+}
+
 // [10, 18), [20, 30)
 template<typename T, typename C>
 bool IntervalIndexer<T, C>::Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental) {
@@ -31,6 +31,19 @@ void InvertedList::Add(bool is_belong_to, int docid) {
     doc_list_.insert(iter, DocidNode(docid, is_belong_to));
 }
 
+bool InvertedList::AddUnique(bool is_belong_to, int docid) {
+    DocidNode node(docid, is_belong_to);
+    auto iter = doc_list_.begin();
+    while (iter != doc_list_.end() && *iter < node) {
+        ++iter;
+    }
+    if (iter != doc_list_.end() && *iter == node) {
+        return false;
+    }
+    doc_list_.insert(iter, node);
+    return true;
+}
+
 void InvertedList::Copy(const InvertedList& other) {
     doc_list_.clear();
     for (auto& p : other.doc_list()) {
@@ -38,6 +51,15 @@ void InvertedList::Copy(const InvertedList& other) {
     }
 }
 
+// sum of DocidNodeHash, cheap filter before a full comparison
+size_t InvertedList::Hash() const {
+    size_t h = 0;
+    for (auto& p : doc_list_) {
+        h += DocidNodeHash(p.docid, p.is_belong_to);
+    }
+    return h;
+}
+
 } // namespace cloris
 
 
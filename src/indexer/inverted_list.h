@@ -8,6 +8,7 @@
 #define CLORIS_INVERTED_LIST_H_
 
 #include <unistd.h>
+#include <stdint.h>
 #include <list>
 
 namespace cloris {
@@ -24,16 +25,28 @@ struct DocidNode {
     bool is_belong_to;
 };
 
+// order independent, so the hash of a list can be maintained incrementally
+inline size_t DocidNodeHash(int docid, bool is_belong_to) {
+    uint64_t h = ((static_cast<uint64_t>(static_cast<uint32_t>(docid)) << 1) | (is_belong_to ? 1 : 0)) + 1;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
 // TODO switch general list to skip list 
 class InvertedList {
 public:
     InvertedList() {}
     ~InvertedList() {}
     void Add(bool is_belong_to, int docid); 
+    // same as Add but skip the node if it is already in the list,
+    // returns false in that case
+    bool AddUnique(bool is_belong_to, int docid);
     void Copy(const InvertedList& other);
     std::list<DocidNode>& mutable_doc_list() { return doc_list_; }
     const std::list<DocidNode>& doc_list() const { return doc_list_; }
     size_t length() const { return doc_list_.size(); }
+    size_t Hash() const;
+    bool operator == (const InvertedList& other) const { return doc_list_ == other.doc_list(); }
 private:
     std::list<DocidNode> doc_list_;
     // skip_list<DocidNode> list;
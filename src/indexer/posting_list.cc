@@ -4,6 +4,7 @@
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <algorithm>
 #include "posting_list.h"
 
 namespace cloris {
@@ -16,16 +17,30 @@ PostingList::PostingList(std::list<DocidNode>* pl, ReclaimHandler handler)
     iter_ = doc_list_->begin();
 }
 
+PostingList::PostingList(const DocListGroup& group) : doc_list_(NULL) {
+    heap_.reserve(group.size());
+    for (auto& p : group) {
+        if (p && !p->empty()) {
+            heap_.push_back(Cursor(p->begin(), p->end()));
+        }
+    }
+    std::make_heap(heap_.begin(), heap_.end());
+}
+
 PostingList::~PostingList() { 
 }
 
 void PostingList::ReclaimDocList() {
-    if (handler_) {
+    if (handler_ && doc_list_) {
         handler_(doc_list_);
     }
 }
 
+// exhausted lists go last, EOL has the smallest docid so it is checked first
 bool PostingList::operator < (const PostingList& pl) const {
+    if (this->CurrentEntry() == EOL) {
+        return false;
+    }
     if (pl.CurrentEntry() == EOL) {
         return true;
     }
@@ -33,6 +48,9 @@ bool PostingList::operator < (const PostingList& pl) const {
 }
 
 const DocidNode& PostingList::CurrentEntry() const {
+    if (!doc_list_) {
+        return heap_.empty() ? EOL : *(heap_.front().iter);
+    }
     if (iter_ == doc_list_->end()) {
         return EOL;
     } else {
@@ -40,10 +58,30 @@ const DocidNode& PostingList::CurrentEntry() const {
     }
 }
 
-void PostingList::SkipTo(int docid) {
+size_t PostingList::SkipTo(int docid) {
+    size_t skipped = 0;
+    if (!doc_list_) {
+        // only the lists lagging behind 'docid' are touched
+        while (!heap_.empty() && (heap_.front().iter->docid < docid)) {
+            std::pop_heap(heap_.begin(), heap_.end());
+            Cursor& cursor = heap_.back();
+            while ((cursor.iter != cursor.end) && (cursor.iter->docid < docid)) {
+                ++cursor.iter;
+                ++skipped;
+            }
+            if (cursor.iter == cursor.end) {
+                heap_.pop_back();
+            } else {
+                std::push_heap(heap_.begin(), heap_.end());
+            }
+        }
+        return skipped;
+    }
     while ((iter_ != doc_list_->end()) && (iter_->docid < docid)) {
         ++iter_;
+        ++skipped;
     }
+    return skipped;
 }
 
 } // namespace cloris
@@ -13,26 +13,62 @@
 #define DN_BAD_DOCID -31415926 
 
 #include <list>
+#include <vector>
 #include <functional>
 #include "inverted_list.h"
 
 namespace cloris {
 
 typedef std::function<void(std::list<DocidNode>*)> ReclaimHandler;
+typedef std::vector<std::list<DocidNode>*> DocListGroup;
 
+//
+// A PostingList is a cursor over one doc list, or over the union of a group of
+// doc lists (e.g. all interval segments overlapping a range query). The union
+// is merged lazily with a min-heap, a docid shared by several lists is only
+// seen once since the cursor always moves forward by SkipTo
+//
 class PostingList {
 public:
     const static DocidNode EOL;
     PostingList(std::list<DocidNode>* pl, ReclaimHandler handler);
+    PostingList(const DocListGroup& group);
+    PostingList(const PostingList& other) = default;
+    PostingList(PostingList&& other) = default;
+    PostingList& operator=(const PostingList& other) = default;
+    PostingList& operator=(PostingList&& other) = default;
     ~PostingList(); 
     bool operator < (const PostingList& pl) const ; 
     const DocidNode& CurrentEntry() const;
-    void SkipTo(int docid);
+    // returns the number of entries passed
+    size_t SkipTo(int docid);
     void ReclaimDocList();
+    // weighted search: the field of the list, the weight of its query term
+    // and the most an entry of it can add to a score
+    void set_score_info(int field, double weight, double upper_bound) {
+        field_ = field;
+        weight_ = weight;
+        upper_bound_ = upper_bound;
+    }
+    int field() const { return field_; }
+    double weight() const { return weight_; }
+    double upper_bound() const { return upper_bound_; }
 private:
+    struct Cursor {
+        Cursor(std::list<DocidNode>::iterator _iter, std::list<DocidNode>::iterator _end)
+            : iter(_iter), end(_end) {}
+        // reversed for std::push_heap, so that the smallest entry is on top
+        bool operator < (const Cursor& other) const { return *other.iter < *iter; }
+        std::list<DocidNode>::iterator iter;
+        std::list<DocidNode>::iterator end;
+    };
     std::list<DocidNode>* doc_list_;
     ReclaimHandler handler_;
     std::list<DocidNode>::iterator iter_;
+    std::vector<Cursor> heap_; // used only in union mode
+    int field_ = -1;
+    double weight_ = 0.0;
+    double upper_bound_ = 0.0;
 };
 
 } // namespace cloris
@@ -0,0 +1,293 @@
+//
+// segment tree indexer main class definition
+// An interval indexer without posting duplication, e.g. time ∈ [2018-01-01, 2019-01-01)
+// version: 1.0
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+// IntervalIndexer slices old nodes and copies their doc lists whenever a new
+// interval overlaps them, so a wide interval is duplicated into every segment
+// that later splits it. SegmentTreeIndexer keeps the intervals as they are and
+// builds a segment tree over all boundary points: each interval is stored at
+// its O(log n) canonical nodes, a point search unions the lists on one
+// root-to-leaf path.
+//
+// boundary points are ordered by (value, flag) as in interval.h, so open and
+// closed ends need no special handling. With sorted distinct points k[0..m),
+// slot 2i+1 stands for "== k[i]" and slot 2i for "between k[i-1] and k[i]",
+// interval [k[a], k[b]] covers slots [2a+1, 2b+1].
+//
+// intervals added since the last build wait in a short pending list, which a
+// search scans linearly. When it is full they get a tree of their own, and
+// trees of similar sizes are merged into one as in the logarithmic method, so
+// a bulk load rebuilds every interval O(log n) times and a search walks
+// O(log n) trees. Compile() merges all into one tree. Searches never modify
+// the indexer, so they can share the read lock. It is meant for read-mostly data
+//
+
+#ifndef CLORIS_SEGMENT_TREE_INDEXER_H_
+#define CLORIS_SEGMENT_TREE_INDEXER_H_
+
+#include <algorithm>
+#include <vector>
+#include "interval_indexer.h"
+
+// most intervals a search scans linearly, Add builds them into a tree beyond this
+#define SEGMENT_TREE_MAX_PENDING    64
+
+namespace cloris {
+
+template<typename T>
+class SegmentTreeIndexer : public Indexer {
+    typedef BoundaryPoint<T> Point;
+    struct Entry {
+        Entry(const Interval<T>& _interval, int _docid, bool _is_belong_to)
+            : interval(_interval), docid(_docid), is_belong_to(_is_belong_to) {}
+        Interval<T> interval;
+        int docid;
+        bool is_belong_to;
+    };
+    // a segment tree over entries_[begin, end)
+    struct Tree {
+        size_t begin;
+        size_t end;
+        std::vector<Point> keys;
+        std::vector<InvertedList> nodes; // 1-based heap layout, leaves start at 'leaves'
+        size_t leaves;
+    };
+public:
+    SegmentTreeIndexer(const std::string& name);
+    ~SegmentTreeIndexer() {}
+    virtual bool ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value);
+    virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental);
+    // a point may hit several canonical nodes, use the DocListGroup version
+    virtual std::list<DocidNode>* GetPostingLists(const Term& term);
+    virtual void GetPostingLists(const Term& term, DocListGroup& group);
+    virtual void Compile();
+    virtual const char* index_type() const { return "segment_tree"; }
+    virtual void GetStats(IndexerStats& stats) const;
+private:
+    // build the pending intervals into a tree, merging the trees that are
+    // not at least twice as large as it
+    void Flush();
+    void Build(size_t begin, size_t end, Tree& tree) const;
+    static size_t Slot(const Tree& tree, const Point& point);
+    static void Collect(Tree& tree, size_t node, size_t lo, size_t hi, size_t left, size_t right, DocListGroup& group);
+
+    std::vector<Entry> entries_;
+    // over consecutive ranges of entries_, each at least twice as large as the next
+    std::vector<Tree> trees_;
+    // one single doc list per interval of entries_[built_, ...), not in a tree yet
+    std::vector<InvertedList> pending_;
+    size_t built_;
+};
+
+template<typename T>
+SegmentTreeIndexer<T>::SegmentTreeIndexer(const std::string& name)
+    : Indexer(name),
+      built_(0) {
+    type_ = IntervalValueType<T>::value;
+}
+
+template<typename T>
+bool SegmentTreeIndexer<T>::ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value) {
+    if (type_ == INT32_INTERVAL) {
+        for (auto& p : value.int32_intvl()) {
+            terms.push_back(Term(name_, p.left(), p.right(), p.flag()));
+        }
+    }  else if (type_ == DOUBLE_INTERVAL) {
+        for (auto& p : value.double_intvl()) {
+            terms.push_back(Term(name_, p.left(), p.right(), p.flag()));
+        }
+    } else if (type_ == STRING_INTERVAL) {
+        for (auto& p : value.string_intvl()) {
+            terms.push_back(Term(name_, p.left(), p.right(), p.flag()));
+        }
+    } else {
+        cLog(WARN, "[segment_tree_indexer warning] unsupported term type");
+    }
+    return true;
+}
+
+template<typename T>
+bool SegmentTreeIndexer<T>::Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental) {
+    std::vector<Term> terms;
+    this->ParseTermsFromConjValue(terms, value);
+    for (auto &term : terms) {
+        IntervalNode<T> node(term, type_);
+        // skip empty intervals like (5, 5)
+        if (!node || node.right() < node.left()) {
+            continue;
+        }
+        entries_.push_back(Entry(node, docid, is_belong_to));
+        pending_.push_back(InvertedList());
+        pending_.back().Add(is_belong_to, docid);
+    }
+    if (pending_.size() > SEGMENT_TREE_MAX_PENDING) {
+        this->Flush();
+    }
+    return true;
+}
+
+template<typename T>
+void SegmentTreeIndexer<T>::Flush() {
+    size_t begin = built_;
+    while (!trees_.empty() && trees_.back().end - trees_.back().begin < 2 * (entries_.size() - begin)) {
+        begin = trees_.back().begin;
+        trees_.pop_back();
+    }
+    trees_.push_back(Tree());
+    this->Build(begin, entries_.size(), trees_.back());
+    pending_.clear();
+    built_ = entries_.size();
+}
+
+template<typename T>
+void SegmentTreeIndexer<T>::Build(size_t begin, size_t end, Tree& tree) const {
+    tree.begin = begin;
+    tree.end = end;
+    std::vector<Point>& keys = tree.keys;
+    keys.reserve((end - begin) * 2);
+    for (size_t i = begin; i < end; ++i) {
+        keys.push_back(entries_[i].interval.left());
+        keys.push_back(entries_[i].interval.right());
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    size_t slots = keys.size() * 2 + 1;
+    size_t leaves = 1;
+    while (leaves < slots) {
+        leaves <<= 1;
+    }
+    tree.leaves = leaves;
+    // (canonical node, doc) pairs, sorted they give every node list in order
+    std::vector<std::pair<size_t, DocidNode>> postings;
+    for (size_t i = begin; i < end; ++i) {
+        const Entry& p = entries_[i];
+        DocidNode doc(p.docid, p.is_belong_to);
+        // both ends are in 'keys', so Slot hits them exactly
+        size_t left = Slot(tree, p.interval.left()) + leaves;
+        size_t right = Slot(tree, p.interval.right()) + leaves + 1;
+        // canonical nodes of [left, right)
+        for (; left < right; left >>= 1, right >>= 1) {
+            if (left & 1) {
+                postings.push_back(std::make_pair(left++, doc));
+            }
+            if (right & 1) {
+                postings.push_back(std::make_pair(--right, doc));
+            }
+        }
+    }
+    std::sort(postings.begin(), postings.end(),
+        [](const std::pair<size_t, DocidNode>& a, const std::pair<size_t, DocidNode>& b) {
+            return (a.first < b.first) || (a.first == b.first && a.second < b.second);
+        });
+    tree.nodes.resize(leaves * 2);
+    for (size_t i = 0; i < postings.size(); ++i) {
+        if (i == 0 || postings[i].first != postings[i - 1].first || postings[i].second != postings[i - 1].second) {
+            tree.nodes[postings[i].first].mutable_doc_list().push_back(postings[i].second);
+        }
+    }
+    cLog(DEBUG, "[segment_tree_indexer] build done, intervals=%zu, keys=%zu, leaves=%zu", end - begin, keys.size(), leaves);
+}
+
+template<typename T>
+void SegmentTreeIndexer<T>::Compile() {
+    if (pending_.empty() && trees_.size() <= 1) {
+        return;
+    }
+    std::vector<Tree>().swap(trees_);
+    trees_.push_back(Tree());
+    this->Build(0, entries_.size(), trees_.back());
+    std::vector<InvertedList>().swap(pending_);
+    built_ = entries_.size();
+    cLog(INFO, "[segment_tree_indexer] compiled, intervals=%zu, keys=%zu", entries_.size(), trees_.back().keys.size());
+}
+
+template<typename T>
+void SegmentTreeIndexer<T>::GetStats(IndexerStats& stats) const {
+    stats.keys += pending_.size();
+    stats.bytes += entries_.capacity() * sizeof(Entry) + trees_.capacity() * sizeof(Tree)
+                   + pending_.capacity() * sizeof(InvertedList);
+    for (auto& node : pending_) {
+        stats.AddList(node.length());
+        stats.bytes += node.length() * POSTING_NODE_BYTES;
+    }
+    // empty tree nodes hold nothing, only their bytes count
+    for (auto& tree : trees_) {
+        stats.bytes += tree.keys.capacity() * sizeof(Point) + tree.nodes.capacity() * sizeof(InvertedList);
+        for (auto& node : tree.nodes) {
+            if (node.length() > 0) {
+                ++stats.keys;
+                stats.AddList(node.length());
+                stats.bytes += node.length() * POSTING_NODE_BYTES;
+            }
+        }
+    }
+}
+
+template<typename T>
+size_t SegmentTreeIndexer<T>::Slot(const Tree& tree, const Point& point) {
+    const std::vector<Point>& keys = tree.keys;
+    size_t i = std::lower_bound(keys.begin(), keys.end(), point) - keys.begin();
+    return (i < keys.size() && keys[i] == point) ? (i * 2 + 1) : (i * 2);
+}
+
+// every node whose span [lo, hi) intersects [left, right] holds intervals overlapping the range
+template<typename T>
+void SegmentTreeIndexer<T>::Collect(Tree& tree, size_t node, size_t lo, size_t hi, size_t left, size_t right,
+        DocListGroup& group) {
+    if (hi <= left || right < lo) {
+        return;
+    }
+    if (tree.nodes[node].length() > 0) {
+        group.push_back(&(tree.nodes[node].mutable_doc_list()));
+    }
+    if (node < tree.leaves) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        Collect(tree, node * 2, lo, mid, left, right, group);
+        Collect(tree, node * 2 + 1, mid, hi, left, right, group);
+    }
+}
+
+template<typename T>
+void SegmentTreeIndexer<T>::GetPostingLists(const Term& term, DocListGroup& group) {
+    IntervalNode<T> search_node(term, type_);
+    if (!search_node) {
+        return;
+    }
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        const Interval<T>& interval = entries_[built_ + i].interval;
+        if (!(interval.right() < search_node.left()) && !(search_node.right() < interval.left())) {
+            group.push_back(&(pending_[i].mutable_doc_list()));
+        }
+    }
+    for (auto& tree : trees_) {
+        if (tree.keys.empty()) {
+            continue;
+        }
+        size_t left = Slot(tree, search_node.left());
+        size_t right = Slot(tree, search_node.right());
+        if (left == right) {
+            // point search, walk up from the leaf
+            for (size_t node = left + tree.leaves; node > 0; node >>= 1) {
+                if (tree.nodes[node].length() > 0) {
+                    group.push_back(&(tree.nodes[node].mutable_doc_list()));
+                }
+            }
+        } else {
+            Collect(tree, 1, 0, tree.leaves, left, right, group);
+        }
+    }
+}
+
+template<typename T>
+std::list<DocidNode>* SegmentTreeIndexer<T>::GetPostingLists(const Term& term) {
+    DocListGroup group;
+    this->GetPostingLists(term, group);
+    return (group.size() == 1) ? group[0] : NULL;
+}
+
+} // namespace cloris
+
+#endif // CLORIS_SEGMENT_TREE_INDEXER_H_
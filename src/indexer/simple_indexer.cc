@@ -57,4 +57,14 @@ std::list<DocidNode>* SimpleIndexer::GetPostingLists(const Term& term) {
     }
 }
 
+void SimpleIndexer::GetStats(IndexerStats& stats) const {
+    stats.keys += inverted_lists_.size();
+    stats.bytes += inverted_lists_.bucket_count() * sizeof(void*);
+    for (auto& p : inverted_lists_) {
+        stats.AddList(p.second.length());
+        stats.bytes += sizeof(p) + HASH_NODE_BYTES + p.first.value().capacity()
+                       + p.second.length() * POSTING_NODE_BYTES;
+    }
+}
+
 } // namespace cloris
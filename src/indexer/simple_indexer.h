@@ -21,6 +21,8 @@ public:
     virtual bool ParseTermsFromConjValue(std::vector<Term>& terms, const ConjValue& value); 
     virtual bool Add(const ConjValue& value, bool is_belong_to, int docid, bool is_incremental);
     virtual std::list<DocidNode>* GetPostingLists(const Term& term);
+    virtual const char* index_type() const { return "simple"; }
+    virtual void GetStats(IndexerStats& stats) const;
 private:
     SimpleIndexer() = delete;
     std::unordered_map<Term, InvertedList, TermHash> inverted_lists_;
@@ -1,95 +1,345 @@
-// 
+//
 // simple log implementation
 // Version:1.0
 // Copyright 2017 James Wei (weijianlhp@163.com)
 //
 
 #include <stdarg.h>
-#include <sys/timeb.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <iostream>
-#include <boost/lexical_cast.hpp>
-#include <boost/format.hpp>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "internal/singleton.h"
 #include "log.h"
 
+// messages longer than this are moved to the heap
+#define LOG_INLINE_SIZE     256
+// records per thread, a power of 2
+#define LOG_RING_SIZE       1024
+// the writer sleeps this long when all rings are empty
+#define LOG_IDLE_WAIT_MS    10
+
 namespace cloris {
 
-static LogLevel g_log_level = LogLevel::DEBUG;
+#ifdef USE_DEBUG
+std::atomic<int> g_log_level(LogLevel::DEBUG);
+#else
+std::atomic<int> g_log_level(LogLevel::OFF);
+#endif
+static std::atomic<size_t> g_log_rate_limit(0);
+// set once the logger is destroyed at exit, later messages are written directly
+static std::atomic<bool> g_log_stopped(false);
 
-void FormatOutput(const char *category, LogLevel level, const char *file_name, int line_num, const char *format, ...) {
-    if (level < g_log_level) {
-        return;
+// one writer at a time: the writer thread, a flush or the fallback at exit
+static std::mutex g_write_mutex;
+
+static const char* g_level_names[] = { "", "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "OFF" };
+
+struct LogRecord {
+    const char *category;
+    const char *file_name;
+    int line_num;
+    LogLevel level;
+    struct timespec time;
+    std::string *long_message; // NULL if the message fits in 'message'
+    char message[LOG_INLINE_SIZE];
+};
+
+//
+// single producer (the owner thread) and single consumer (the writer) ring,
+// 'head_' is only written by the producer and 'tail_' by the consumer
+//
+class LogRing : boost::noncopyable {
+public:
+    LogRing() : head_(0), tail_(0), closed_(false), dropped_(0), window_(0), window_count_(0) {}
+    LogRecord* Reserve() {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+            return NULL;
+        }
+        return &records_[head & (LOG_RING_SIZE - 1)];
     }
-    int size = 2048;
-    char *buf = NULL;
-    char *new_buf = NULL;
-    buf = (char *)malloc(size);
-    if (!buf) {
-        return;
+    void Commit() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    // the consumer reads records in [tail, head) in place and releases them
+    // with Advance once they are written
+    LogRecord* At(uint64_t pos) { return &records_[pos & (LOG_RING_SIZE - 1)]; }
+    void Advance(uint64_t n) { tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+    uint64_t head() const { return head_.load(std::memory_order_acquire); }
+    uint64_t tail() const { return tail_.load(std::memory_order_acquire); }
+    void Close() { closed_.store(true, std::memory_order_release); }
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+    void Drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+    size_t TakeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+    // producer side, true if one more message fits in the current second
+    bool Admit(time_t now, size_t limit) {
+        if (limit == 0) {
+            return true;
+        }
+        if (now != window_) {
+            window_ = now;
+            window_count_ = 0;
+        }
+        return ++window_count_ <= limit;
     }
-    va_list ap;
-    int n;
+private:
+    LogRecord records_[LOG_RING_SIZE];
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> tail_;
+    std::atomic<bool> closed_; // the owner thread has exited
+    std::atomic<size_t> dropped_;
+    time_t window_;
+    size_t window_count_;
+};
+
+// only called by one thread at a time, localtime_r is redone once per second
+static void WriteRecord(FILE *out, const LogRecord& record) {
+    static time_t last_sec = -1;
+    static struct tm tmstru;
+    if (record.time.tv_sec != last_sec) {
+        localtime_r(&record.time.tv_sec, &tmstru);
+        last_sec = record.time.tv_sec;
+    }
+    fprintf(out, "[%s] %2d-%02d-%02d %02d:%02d:%02d:%03d [%s] [%d] <%s:%d>\t%s\n",
+            record.category,
+            tmstru.tm_year + 1900,
+            tmstru.tm_mon + 1,
+            tmstru.tm_mday,
+            tmstru.tm_hour,
+            tmstru.tm_min,
+            tmstru.tm_sec,
+            static_cast<int>(record.time.tv_nsec / 1000000),
+            g_level_names[record.level],
+            getpid(),
+            record.file_name,
+            record.line_num,
+            record.long_message ? record.long_message->c_str() : record.message);
+}
+
+//
+// owns the rings of all threads and the writer thread, which is started by
+// the first message. Records of one pass are written in time order
+//
+class AsyncLogger : boost::noncopyable {
+public:
+    AsyncLogger();
+    ~AsyncLogger();
+    LogRing* ring();
+    void Flush();
+private:
+    static void* WriterRoutine(void *arg);
+    // write all pending records, returns how many were written
+    size_t Drain();
+
+    std::mutex rings_mutex_; // guards 'rings_', taken once per thread and by the writer
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    pthread_t writer_;
+    bool running_;
+    bool stopped_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
+    FILE *out_;
+};
+
+// closes the ring of a thread when the thread exits, the writer frees it
+struct LogRingHolder {
+    ~LogRingHolder() {
+        if (ring) {
+            ring->Close();
+        }
+    }
+    std::shared_ptr<LogRing> ring;
+};
+
+static thread_local LogRingHolder t_ring_holder;
+
+AsyncLogger::AsyncLogger() : running_(false), stopped_(false), out_(stdout) {
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+}
+
+AsyncLogger::~AsyncLogger() {
+    g_log_stopped.store(true);
+    if (running_) {
+        pthread_mutex_lock(&mutex_);
+        stopped_ = true;
+        pthread_cond_signal(&cond_);
+        pthread_mutex_unlock(&mutex_);
+        pthread_join(writer_, NULL);
+    }
+    this->Drain();
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+LogRing* AsyncLogger::ring() {
+    if (t_ring_holder.ring) {
+        return t_ring_holder.ring.get();
+    }
+    std::shared_ptr<LogRing> ring(new LogRing());
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    if (!running_) {
+        running_ = (pthread_create(&writer_, NULL, AsyncLogger::WriterRoutine, this) == 0);
+        if (!running_) {
+            return NULL;
+        }
+    }
+    rings_.push_back(ring);
+    t_ring_holder.ring = ring;
+    return ring.get();
+}
+
+size_t AsyncLogger::Drain() {
+    std::lock_guard<std::mutex> write_guard(g_write_mutex);
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        rings = rings_;
+    }
+    std::vector<std::pair<LogRing*, uint64_t>> batches; // ring, records taken
+    std::vector<LogRecord*> records;
+    size_t dropped = 0;
+    for (auto& ring : rings) {
+        uint64_t tail = ring->tail();
+        uint64_t n = ring->head() - tail;
+        for (uint64_t i = 0; i < n; ++i) {
+            records.push_back(ring->At(tail + i));
+        }
+        if (n > 0) {
+            batches.push_back(std::make_pair(ring.get(), n));
+        }
+        dropped += ring->TakeDropped();
+    }
+    std::stable_sort(records.begin(), records.end(), [](const LogRecord* a, const LogRecord* b) {
+        return (a->time.tv_sec != b->time.tv_sec) ? (a->time.tv_sec < b->time.tv_sec) : (a->time.tv_nsec < b->time.tv_nsec);
+    });
+    for (auto record : records) {
+        WriteRecord(out_, *record);
+        if (record->long_message) {
+            delete record->long_message;
+            record->long_message = NULL;
+        }
+    }
+    if (dropped > 0) {
+        fprintf(out_, "[CLORIS] %zu log messages dropped by rate limit or full buffers\n", dropped);
+    }
+    if (!records.empty() || dropped > 0) {
+        fflush(out_);
+    }
+    for (auto& p : batches) {
+        p.first->Advance(p.second);
+    }
+    {
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<LogRing>& r) {
+            return r->closed() && r->head() == r->tail();
+        }), rings_.end());
+    }
+    return records.size();
+}
+
+void AsyncLogger::Flush() {
+    this->Drain();
+}
+
+void* AsyncLogger::WriterRoutine(void *arg) {
+    AsyncLogger *logger = static_cast<AsyncLogger*>(arg);
     while (true) {
-        va_start(ap, format);
-        n = vsnprintf(buf, size, format, ap);
-        va_end(ap);
-        if (n > -1 && n < size) {
+        if (logger->Drain() > 0) {
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&logger->mutex_);
+        bool stopped = logger->stopped_;
+        if (!stopped) {
+            pthread_cond_timedwait(&logger->cond_, &logger->mutex_, &deadline);
+            stopped = logger->stopped_;
+        }
+        pthread_mutex_unlock(&logger->mutex_);
+        if (stopped) {
             break;
         }
-        if (n > -1) {
-            size = n + 1;
-        } else {
-            size = size << 1;
+    }
+    return NULL;
+}
+
+void SetLogLevel(LogLevel level) {
+    g_log_level.store(level, std::memory_order_relaxed);
+}
+
+void SetLogRateLimit(size_t per_second) {
+    g_log_rate_limit.store(per_second, std::memory_order_relaxed);
+}
+
+void FlushLog() {
+    if (!g_log_stopped.load()) {
+        Singleton<AsyncLogger>::instance()->Flush();
+    }
+}
+
+void FormatOutput(const char *category, LogLevel level, const char *file_name, int line_num, const char *format, ...) {
+    LogRecord local;
+    LogRecord *record = &local;
+    AsyncLogger *logger = NULL;
+    LogRing *ring = NULL;
+    clock_gettime(CLOCK_REALTIME, &local.time);
+    if (!g_log_stopped.load(std::memory_order_relaxed)) {
+        logger = Singleton<AsyncLogger>::instance();
+        ring = logger->ring();
+    }
+    if (ring) {
+        if (!ring->Admit(local.time.tv_sec, g_log_rate_limit.load(std::memory_order_relaxed))) {
+            ring->Drop();
+            return;
         }
-        new_buf = (char*)realloc(buf, size);
-        if (!new_buf) {
-            free(buf);
+        record = ring->Reserve();
+        if (!record) {
+            ring->Drop();
             return;
-        } else {
-            buf = new_buf;
         }
+        record->time = local.time;
+    }
+    record->category = category;
+    record->file_name = file_name;
+    record->line_num = line_num;
+    record->level = level;
+    record->long_message = NULL;
+
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(record->message, LOG_INLINE_SIZE, format, ap);
+    va_end(ap);
+    if (n >= LOG_INLINE_SIZE) {
+        record->long_message = new std::string(n, '\0');
+        va_start(ap, format);
+        vsnprintf(&(*record->long_message)[0], n + 1, format, ap);
+        va_end(ap);
+    }
+
+    if (!ring) {
+        // no writer, at exit or if it failed to start
+        std::lock_guard<std::mutex> guard(g_write_mutex);
+        WriteRecord(stdout, *record);
+        fflush(stdout);
+        delete record->long_message;
+        return;
+    }
+    ring->Commit();
+    if (level >= FATAL) {
+        logger->Flush();
     }
-    std::string str_level;
-    if (level == TRACE) {
-        str_level = "TRACE";
-    } else if (level == DEBUG) {
-        str_level = "DEBUG";
-    } else if (level == INFO) {
-        str_level = "INFO";
-    } else if (level == WARN) {
-        str_level = "WARN";
-    } else if (level == ERROR) {
-        str_level = "ERROR";
-    } else if (level == FATAL) {
-        str_level = "FATAL";
-    }
-
-    time_t timenow;
-    struct timeb  tmb;
-    struct tm     tmstru;
-    time(&timenow);
-    localtime_r(&timenow, &tmstru);
-    ftime(&tmb);
-
-    std::string message = boost::str(
-            boost::format("[%s] %2d-%02d-%02d %02d:%02d:%02d:%03d [%s] [%d] <%s:%d>\t")
-            % category
-            % (tmstru.tm_year + 1900)
-            % (tmstru.tm_mon + 1)
-            % tmstru.tm_mday
-            % tmstru.tm_hour
-            % tmstru.tm_min 
-            % tmstru.tm_sec
-            % tmb.millitm
-            % str_level
-            % getpid()
-            % file_name
-            % line_num
-            ); 
-    message += buf;
-
-    // TODO support more output format and methods 
-    std::cout << message << std::endl;
 }
 
 } // namespace cloris
@@ -1,30 +1,36 @@
-// 
+//
 // Simple log implementation
 // Version:1.0
 // Copyright (C) 2017 James Wei (weijianlhp@163.com). All rights reserved
 //
+// messages are formatted on the calling thread into a per-thread ring buffer,
+// a background thread adds the headers and writes them out, so a cLog costs
+// a vsnprintf and no lock, allocation or system call. The level is checked at
+// runtime before the arguments are evaluated
+//
 
 #ifndef CLORIS_LOG_H_
 #define CLORIS_LOG_H_
 
-#define BUG_ON(args) 
+#define BUG_ON(args)
 #define BUG(args)
 
+#include <stddef.h>
+#include <atomic>
 #include "internal/def.h"
 
-#ifdef USE_DEBUG 
-    #define cLog(level, format, ...) \
-        FormatOutput("CLORIS", level, __FILE__, __LINE__, format, ##__VA_ARGS__)
-    #define cLogIf(cond, level, format, ...) \
-        do {  \
-            if (cond) { FormatOutput("CLORIS", level, __FILE__, __LINE__, format, ##__VA_ARGS__); } \
-        } while (0) 
-#else 
-    #define cLog(level, format, ...) \
-        void(0)
-    #define cLogIf(cond, level, format, ...) \
-        void(0)
-#endif
+#define cLog(level, format, ...) \
+    do { \
+        if (::cloris::LogEnabled(level)) { \
+            FormatOutput("CLORIS", level, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+#define cLogIf(cond, level, format, ...) \
+    do {  \
+        if ((cond) && ::cloris::LogEnabled(level)) { \
+            FormatOutput("CLORIS", level, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while (0)
 
 namespace cloris {
 
@@ -35,9 +41,27 @@ enum LogLevel {
     WARN  = 4,
     ERROR = 5,
     FATAL = 6,
+    OFF   = 7, // above every message level, nothing is logged
 };
 
-void FormatOutput(const char *category, LogLevel level, const char *file_name, int line_num, const char *format, ...); 
+// DEBUG if built with USE_DEBUG, OFF otherwise, so release builds stay as
+// quiet as when cLog was compiled out. SetLogLevel(WARN) turns warnings on
+extern std::atomic<int> g_log_level;
+
+inline bool LogEnabled(LogLevel level) {
+    return level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+void SetLogLevel(LogLevel level);
+// at most 'per_second' messages per thread and second, the rest are dropped
+// and reported as a count, 0 means unlimited
+void SetLogRateLimit(size_t per_second);
+// wait until the messages logged so far are written, FATAL messages flush
+void FlushLog();
+
+// not filtered by level, cLog checks it before the arguments are evaluated
+void FormatOutput(const char *category, LogLevel level, const char *file_name, int line_num, const char *format, ...)
+    __attribute__((format(printf, 5, 6)));
 
 } // namespace cloris
 
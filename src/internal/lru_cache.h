@@ -0,0 +1,91 @@
+//
+// sharded LRU cache
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_LRU_CACHE_H_
+#define CLORIS_LRU_CACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace cloris {
+
+// keys are spread over the shards so that concurrent readers seldom contend,
+// each shard is an independent LRU list guarded by its own mutex
+template <typename K, typename V, typename H = std::hash<K>>
+class ShardedLRUCache : boost::noncopyable {
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::pair<K, V>> items; // most recently used first
+        std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, H> index;
+    };
+public:
+    ShardedLRUCache(size_t capacity, size_t shard_num = 16);
+    ~ShardedLRUCache() {}
+    bool Get(const K& key, V* value);
+    void Put(const K& key, const V& value);
+    void Clear();
+private:
+    Shard& shard(const K& key) { return *shards_[H()(key) % shards_.size()]; }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_capacity_;
+};
+
+template <typename K, typename V, typename H>
+ShardedLRUCache<K, V, H>::ShardedLRUCache(size_t capacity, size_t shard_num)
+    : shard_capacity_((capacity + shard_num - 1) / shard_num) {
+    for (size_t i = 0; i < shard_num; ++i) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+template <typename K, typename V, typename H>
+bool ShardedLRUCache<K, V, H>::Get(const K& key, V* value) {
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> guard(s.mutex);
+    auto iter = s.index.find(key);
+    if (iter == s.index.end()) {
+        return false;
+    }
+    s.items.splice(s.items.begin(), s.items, iter->second);
+    *value = iter->second->second;
+    return true;
+}
+
+template <typename K, typename V, typename H>
+void ShardedLRUCache<K, V, H>::Put(const K& key, const V& value) {
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> guard(s.mutex);
+    auto iter = s.index.find(key);
+    if (iter != s.index.end()) {
+        iter->second->second = value;
+        s.items.splice(s.items.begin(), s.items, iter->second);
+        return;
+    }
+    s.items.push_front(std::make_pair(key, value));
+    s.index[key] = s.items.begin();
+    if (s.items.size() > shard_capacity_) {
+        s.index.erase(s.items.back().first);
+        s.items.pop_back();
+    }
+}
+
+template <typename K, typename V, typename H>
+void ShardedLRUCache<K, V, H>::Clear() {
+    for (auto& p : shards_) {
+        std::lock_guard<std::mutex> guard(p->mutex);
+        p->items.clear();
+        p->index.clear();
+    }
+}
+
+} // namespace cloris
+
+#endif // CLORIS_LRU_CACHE_H_
@@ -0,0 +1,231 @@
+//
+// metrics registry implementation
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <algorithm>
+#include <sstream>
+#include "metrics.h"
+
+namespace cloris {
+
+static const double g_percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+uint64_t HistogramBucketUpperBound(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int exp = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS);
+    int shift = exp - HISTOGRAM_SUB_BITS;
+    return (sub << shift) + ((1ULL << shift) - 1);
+}
+
+void HistogramSnapshot::Merge(const HistogramSnapshot& other) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = (other.max > max) ? other.max : max;
+}
+
+uint64_t HistogramSnapshot::Percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+    rank = (rank == 0) ? 1 : rank;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t bound = HistogramBucketUpperBound(i);
+            return (bound < max) ? bound : max;
+        }
+    }
+    return max;
+}
+
+size_t MetricsThreadSlot() {
+    static std::atomic<size_t> next(0);
+    static thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % METRICS_SLOTS;
+    return slot;
+}
+
+uint64_t Counter::Value() const {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < METRICS_SLOTS; ++i) {
+        sum += slots_[i].value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : counts_(new std::atomic<uint64_t>[HISTOGRAM_BUCKETS]),
+      count_(0),
+      sum_(0),
+      max_(0) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+    counts_[HistogramBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+// not atomic as a whole, a snapshot taken under load may be off by the few
+// records in flight
+HistogramSnapshot LatencyHistogram::Snapshot() const {
+    HistogramSnapshot snapshot;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.counts[i];
+    }
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+Metrics::Metrics()
+    : start_ns_(NowNanos()),
+      last_snapshot_ns_(start_ns_),
+      last_searches_(0) {
+}
+
+void Metrics::DeclareField(const std::string& name) {
+    if (fetch_latency_.find(name) == fetch_latency_.end()) {
+        fetch_latency_[name].reset(new LatencyHistogram());
+    }
+}
+
+void Metrics::Snapshot(MetricsSnapshot& snapshot) {
+    uint64_t now = NowNanos();
+    snapshot.uptime = (now - start_ns_) / 1e9;
+    snapshot.searches = searches_.Value();
+    snapshot.adds = adds_.Value();
+    snapshot.add_failures = add_failures_.Value();
+    snapshot.compactions = compactions_.Value();
+    snapshot.search_latency = search_latency_.Snapshot();
+    snapshot.add_latency = add_latency_.Snapshot();
+    snapshot.fetch_latency.clear();
+    for (auto& p : fetch_latency_) {
+        snapshot.fetch_latency.push_back(std::make_pair(p.first, p.second->Snapshot()));
+    }
+    std::sort(snapshot.fetch_latency.begin(), snapshot.fetch_latency.end(),
+            [](const std::pair<std::string, HistogramSnapshot>& a, const std::pair<std::string, HistogramSnapshot>& b) {
+                return a.first < b.first;
+            });
+    std::lock_guard<std::mutex> guard(snapshot_mutex_);
+    double elapsed = (now - last_snapshot_ns_) / 1e9;
+    snapshot.qps = (elapsed > 0) ? (snapshot.searches - last_searches_) / elapsed : 0.0;
+    last_snapshot_ns_ = now;
+    last_searches_ = snapshot.searches;
+}
+
+// fetch latencies are kept by field, the type comes from the index sizes
+static std::string IndexTypeOf(const std::vector<IndexerStats>& indexers, const std::string& name) {
+    for (auto& p : indexers) {
+        if (p.name == name) {
+            return p.index_type;
+        }
+    }
+    return "unknown";
+}
+
+static void WriteHistogramText(std::stringstream& ss, const std::string& name, const HistogramSnapshot& h) {
+    ss << name << "_count " << h.count << "\n"
+       << name << "_mean " << h.Mean() << "\n";
+    for (double p : g_percentiles) {
+        ss << name << "_p" << p << " " << h.Percentile(p) << "\n";
+    }
+    ss << name << "_max " << h.max << "\n";
+}
+
+std::string MetricsSnapshot::ToText() const {
+    std::stringstream ss;
+    ss << "uptime_seconds " << uptime << "\n"
+       << "qps " << qps << "\n"
+       << "searches " << searches << "\n"
+       << "adds " << adds << "\n"
+       << "add_failures " << add_failures << "\n"
+       << "compactions " << compactions << "\n";
+    WriteHistogramText(ss, "search_latency_ns", search_latency);
+    WriteHistogramText(ss, "add_latency_ns", add_latency);
+    for (auto& p : fetch_latency) {
+        if (p.second.count) {
+            WriteHistogramText(ss, "fetch_latency_ns{" + p.first + "," + IndexTypeOf(indexers, p.first) + "}", p.second);
+        }
+    }
+    size_t bytes = 0;
+    for (auto& p : indexers) {
+        std::string field = "{" + p.name + "," + p.index_type + "}";
+        ss << "keys" << field << " " << p.keys << "\n"
+           << "lists" << field << " " << p.lists << "\n"
+           << "postings" << field << " " << p.postings << "\n"
+           << "bytes" << field << " " << p.bytes << "\n";
+        WriteHistogramText(ss, "posting_length" + field, p.posting_lengths);
+        bytes += p.bytes;
+    }
+    ss << "zero_postings " << zero_postings << "\n"
+       << "bytes " << bytes << "\n";
+    return ss.str();
+}
+
+static void WriteSummary(std::stringstream& ss, const std::string& name, const std::string& labels,
+        const HistogramSnapshot& h, double scale) {
+    std::string sep = labels.empty() ? "" : ",";
+    for (double p : g_percentiles) {
+        ss << name << "{" << labels << sep << "quantile=\"" << p / 100.0 << "\"} " << h.Percentile(p) * scale << "\n";
+    }
+    std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+    ss << name << "_sum" << suffix << " " << h.sum * scale << "\n"
+       << name << "_count" << suffix << " " << h.count << "\n";
+}
+
+std::string MetricsSnapshot::ToPrometheus(const std::string& prefix) const {
+    std::stringstream ss;
+    const std::string& p = prefix;
+    ss << "# TYPE " << p << "_uptime_seconds gauge\n" << p << "_uptime_seconds " << uptime << "\n"
+       << "# TYPE " << p << "_searches_total counter\n" << p << "_searches_total " << searches << "\n"
+       << "# TYPE " << p << "_adds_total counter\n" << p << "_adds_total " << adds << "\n"
+       << "# TYPE " << p << "_add_failures_total counter\n" << p << "_add_failures_total " << add_failures << "\n"
+       << "# TYPE " << p << "_compactions_total counter\n" << p << "_compactions_total " << compactions << "\n";
+    ss << "# TYPE " << p << "_search_latency_seconds summary\n";
+    WriteSummary(ss, p + "_search_latency_seconds", "", search_latency, 1e-9);
+    ss << "# TYPE " << p << "_add_latency_seconds summary\n";
+    WriteSummary(ss, p + "_add_latency_seconds", "", add_latency, 1e-9);
+    if (!fetch_latency.empty()) {
+        ss << "# TYPE " << p << "_fetch_latency_seconds summary\n";
+        for (auto& f : fetch_latency) {
+            if (f.second.count) {
+                WriteSummary(ss, p + "_fetch_latency_seconds",
+                        "field=\"" + f.first + "\",type=\"" + IndexTypeOf(indexers, f.first) + "\"", f.second, 1e-9);
+            }
+        }
+    }
+    const char* gauges[] = { "keys", "lists", "postings", "bytes" };
+    for (size_t i = 0; i < sizeof(gauges) / sizeof(gauges[0]); ++i) {
+        ss << "# TYPE " << p << "_index_" << gauges[i] << " gauge\n";
+        for (auto& s : indexers) {
+            size_t value = (i == 0) ? s.keys : (i == 1) ? s.lists : (i == 2) ? s.postings : s.bytes;
+            ss << p << "_index_" << gauges[i] << "{field=\"" << s.name << "\",type=\"" << s.index_type << "\"} "
+               << value << "\n";
+        }
+    }
+    ss << "# TYPE " << p << "_posting_length summary\n";
+    for (auto& s : indexers) {
+        WriteSummary(ss, p + "_posting_length", "field=\"" + s.name + "\",type=\"" + s.index_type + "\"",
+                s.posting_lengths, 1.0);
+    }
+    ss << "# TYPE " << p << "_zero_postings gauge\n" << p << "_zero_postings " << zero_postings << "\n";
+    return ss.str();
+}
+
+} // namespace cloris
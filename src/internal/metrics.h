@@ -0,0 +1,194 @@
+//
+// metrics registry: lock-free counters and latency histograms on the hot
+// path, index size gauges collected on demand, text and prometheus output
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_METRICS_H_
+#define CLORIS_METRICS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace cloris {
+
+//
+// log-linear buckets as in HdrHistogram: values below 16 have a bucket each,
+// every power of two above is split into 16 buckets, so a bucket is at most
+// 1/16 of its value wide and percentiles are within ~6% of the exact value
+//
+static const int HISTOGRAM_SUB_BITS = 4;
+static const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+static const int HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+inline int HistogramBucket(uint64_t value) {
+    if (value < static_cast<uint64_t>(HISTOGRAM_SUB_BUCKETS)) {
+        return static_cast<int>(value);
+    }
+    int exp = 63 - __builtin_clzll(value);
+    return (exp - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS
+           + static_cast<int>((value >> (exp - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// largest value of a bucket
+uint64_t HistogramBucketUpperBound(int bucket);
+
+// a plain histogram, the result of a snapshot or of a single-threaded walk
+struct HistogramSnapshot {
+    HistogramSnapshot() : counts(HISTOGRAM_BUCKETS, 0), count(0), sum(0), max(0) {}
+    void Record(uint64_t value) {
+        ++counts[HistogramBucket(value)];
+        ++count;
+        sum += value;
+        max = (value > max) ? value : max;
+    }
+    void Merge(const HistogramSnapshot& other);
+    // 'p' in [0, 100], 0 for an empty histogram
+    uint64_t Percentile(double p) const;
+    double Mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// threads are given one of the slots round robin on first use
+size_t MetricsThreadSlot();
+static const size_t METRICS_SLOTS = 16;
+
+//
+// a counter split in cache line sized slots, concurrent writers seldom share
+// a line, a read sums the slots. Slots are padded rather than aligned, so
+// that owners of a counter need no over-aligned new
+//
+class Counter : boost::noncopyable {
+    struct Slot {
+        Slot() : value(0) {}
+        std::atomic<uint64_t> value;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+public:
+    Counter() {}
+    void Add(uint64_t n = 1) { slots_[MetricsThreadSlot()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const;
+private:
+    Slot slots_[METRICS_SLOTS];
+};
+
+// recording is a few relaxed atomic adds, no lock
+class LatencyHistogram : boost::noncopyable {
+public:
+    LatencyHistogram();
+    void Record(uint64_t value);
+    HistogramSnapshot Snapshot() const;
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+// the size of the index structures of one field, summed over all partitions
+struct IndexerStats {
+    IndexerStats() : keys(0), lists(0), postings(0), bytes(0) {}
+    void AddList(size_t length) {
+        ++lists;
+        postings += length;
+        posting_lengths.Record(length);
+    }
+    std::string name;
+    std::string index_type;
+    size_t keys;     // terms, segments, tree nodes, geo cells or areas
+    size_t lists;    // non-empty posting lists
+    size_t postings; // docid entries in all lists
+    size_t bytes;    // estimated from element sizes, allocator overhead excluded
+    HistogramSnapshot posting_lengths;
+};
+
+// approximate sizes used by the estimates, a std::list node carries two links
+static const size_t POSTING_NODE_BYTES = 2 * sizeof(void*) + 8;
+static const size_t HASH_NODE_BYTES = 2 * sizeof(void*);
+// links of a skip list node, about two levels on average and a back link
+static const size_t SKIP_NODE_BYTES = 4 * sizeof(void*);
+
+struct MetricsSnapshot {
+    MetricsSnapshot()
+        : uptime(0), qps(0), searches(0), adds(0), add_failures(0), compactions(0), zero_postings(0) {}
+    double uptime;      // seconds since the registry was created
+    double qps;         // searches per second since the previous snapshot
+    uint64_t searches;
+    uint64_t adds;
+    uint64_t add_failures;
+    uint64_t compactions;
+    HistogramSnapshot search_latency; // in nanoseconds
+    HistogramSnapshot add_latency;    // in nanoseconds
+    // per field posting list fetch latency in nanoseconds, if enabled
+    std::vector<std::pair<std::string, HistogramSnapshot>> fetch_latency;
+    std::vector<IndexerStats> indexers;
+    size_t zero_postings; // docs in the list of conjunction size 0
+
+    // one "name value" line per metric
+    std::string ToText() const;
+    // prometheus text exposition format, latencies in seconds
+    std::string ToPrometheus(const std::string& prefix = "clorisearch") const;
+};
+
+//
+// owned by CloriSearch, updated by every Add and Search. Index sizes are not
+// tracked on the write path, they are collected by walking the indexers when
+// a snapshot is taken
+//
+class Metrics : boost::noncopyable {
+public:
+    Metrics();
+    ~Metrics() {}
+    void RecordSearch(uint64_t ns) {
+        searches_.Add();
+        search_latency_.Record(ns);
+    }
+    void RecordAdd(uint64_t ns, bool ok) {
+        adds_.Add();
+        if (!ok) {
+            add_failures_.Add();
+        }
+        add_latency_.Record(ns);
+    }
+    void RecordCompaction() { compactions_.Add(); }
+    // must be declared before the searches start, the lookup is not locked
+    void DeclareField(const std::string& name);
+    LatencyHistogram* fetch_latency(const std::string& name) {
+        auto iter = fetch_latency_.find(name);
+        return (iter == fetch_latency_.end()) ? NULL : iter->second.get();
+    }
+    // fills everything but the index sizes
+    void Snapshot(MetricsSnapshot& snapshot);
+
+    static uint64_t NowNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+private:
+    Counter searches_;
+    Counter adds_;
+    Counter add_failures_;
+    Counter compactions_;
+    LatencyHistogram search_latency_;
+    LatencyHistogram add_latency_;
+    std::unordered_map<std::string, std::unique_ptr<LatencyHistogram>> fetch_latency_;
+    uint64_t start_ns_;
+    std::mutex snapshot_mutex_; // guards the two fields below
+    uint64_t last_snapshot_ns_;
+    uint64_t last_searches_;
+};
+
+} // namespace cloris
+
+#endif // CLORIS_METRICS_H_
@@ -0,0 +1,71 @@
+//
+// per query trace implementation
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <string.h>
+#include <chrono>
+#include <sstream>
+#include "query_trace.h"
+
+namespace cloris {
+
+static const char* g_stage_names[TS_STAGE_NUM] = {
+    "std_query", "posting_fetch", "geo_expand", "scorer", "merge"
+};
+
+// spin about 10ms on the steady clock, it is done once per process
+static double CalibrateTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_ticks = TraceTicks();
+    std::chrono::steady_clock::time_point now;
+    do {
+        now = std::chrono::steady_clock::now();
+    } while (now - start < std::chrono::milliseconds(10));
+    uint64_t ticks = TraceTicks() - start_ticks;
+    return ticks / std::chrono::duration<double, std::micro>(now - start).count();
+#else
+    return 1000.0;
+#endif
+}
+
+double TraceTicksPerMicrosecond() {
+    static const double ticks_per_us = CalibrateTicks();
+    return ticks_per_us;
+}
+
+void QueryTrace::Reset() {
+    memset(stage_ticks_, 0, sizeof(stage_ticks_));
+    total_ticks_ = 0;
+    postings_scanned_ = 0;
+    postings_skipped_ = 0;
+    partitions_pruned_ = 0;
+    nearest_rounds_ = 0;
+    partitions_.clear();
+}
+
+std::string QueryTrace::ToString() const {
+    double ticks_per_us = TraceTicksPerMicrosecond();
+    std::stringstream ss;
+    ss.precision(3);
+    ss << std::fixed << "{\"total_us\":" << total_ticks_ / ticks_per_us;
+    for (int i = 0; i < TS_STAGE_NUM; ++i) {
+        ss << ",\"" << g_stage_names[i] << "_us\":" << stage_ticks_[i] / ticks_per_us;
+    }
+    ss << ",\"postings_scanned\":" << postings_scanned_
+       << ",\"postings_skipped\":" << postings_skipped_
+       << ",\"partitions_pruned\":" << partitions_pruned_
+       << ",\"nearest_rounds\":" << nearest_rounds_ << ",\"partitions\":[";
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        const PartitionTrace& p = partitions_[i];
+        ss << (i ? "," : "") << "{\"conjunctions\":" << p.conjunctions
+           << ",\"fetch_us\":" << p.fetch_ticks / ticks_per_us
+           << ",\"scorer_us\":" << p.scorer_ticks / ticks_per_us
+           << ",\"lists\":" << p.lists << ",\"matched\":" << p.matched << "}";
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+} // namespace cloris
@@ -0,0 +1,115 @@
+//
+// per query trace: time spent in every search stage and scorer counters
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_QUERY_TRACE_H_
+#define CLORIS_QUERY_TRACE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace cloris {
+
+enum TraceStage {
+    TS_STD_QUERY     = 0, // drop query terms unknown to the schema
+    TS_POSTING_FETCH = 1, // posting lists of the non-geo terms
+    TS_GEO_EXPAND    = 2, // geohash cells and distance filter of the geo terms
+    TS_SCORER        = 3, // conjunction algorithm
+    TS_MERGE         = 4, // results of all partitions
+    TS_STAGE_NUM     = 5,
+};
+
+// time stamp counter, or nanoseconds where there is none
+inline uint64_t TraceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// calibrated against the steady clock on first use, never on the search path
+double TraceTicksPerMicrosecond();
+
+// one partition is the IndexerManager of one conjunction size
+struct PartitionTrace {
+    PartitionTrace(size_t _conjunctions)
+        : conjunctions(_conjunctions), fetch_ticks(0), scorer_ticks(0), lists(0), matched(0) {}
+    size_t conjunctions;
+    uint64_t fetch_ticks;
+    uint64_t scorer_ticks;
+    size_t lists;   // posting lists handed to the scorer
+    size_t matched;
+};
+
+//
+// filled by a search which is given a trace, only plain adds are done on the
+// search path, formatting happens in ToString when the caller asks for it
+//
+class QueryTrace {
+public:
+    QueryTrace() { Reset(); }
+    ~QueryTrace() {}
+    void Reset();
+    void AddTicks(TraceStage stage, uint64_t ticks) { stage_ticks_[stage] += ticks; }
+    void set_total_ticks(uint64_t ticks) { total_ticks_ = ticks; }
+    PartitionTrace& AddPartition(size_t conjunctions) {
+        partitions_.push_back(PartitionTrace(conjunctions));
+        return partitions_.back();
+    }
+    // scorer counters: candidate entries examined and entries passed by skips
+    void AddScanned(size_t n) { postings_scanned_ += n; }
+    void AddSkipped(size_t n) { postings_skipped_ += n; }
+    // partitions a top-k search passed over as their bound can't beat the k-th score
+    void AddPrunedPartitions(size_t n) { partitions_pruned_ += n; }
+    // radius rounds of a nearest search
+    void AddNearestRound() { ++nearest_rounds_; }
+
+    double stage_us(TraceStage stage) const { return stage_ticks_[stage] / TraceTicksPerMicrosecond(); }
+    double total_us() const { return total_ticks_ / TraceTicksPerMicrosecond(); }
+    uint64_t postings_scanned() const { return postings_scanned_; }
+    uint64_t postings_skipped() const { return postings_skipped_; }
+    uint64_t partitions_pruned() const { return partitions_pruned_; }
+    uint64_t nearest_rounds() const { return nearest_rounds_; }
+    const std::vector<PartitionTrace>& partitions() const { return partitions_; }
+    // one line json, times in microseconds
+    std::string ToString() const;
+private:
+    uint64_t stage_ticks_[TS_STAGE_NUM];
+    uint64_t total_ticks_;
+    uint64_t postings_scanned_;
+    uint64_t postings_skipped_;
+    uint64_t partitions_pruned_;
+    uint64_t nearest_rounds_;
+    std::vector<PartitionTrace> partitions_;
+};
+
+// adds the ticks of its scope to a stage, does nothing without a trace
+class TraceTimer {
+public:
+    TraceTimer(QueryTrace *trace, TraceStage stage)
+        : trace_(trace), stage_(stage), start_(trace ? TraceTicks() : 0) {}
+    ~TraceTimer() {
+        if (trace_) {
+            trace_->AddTicks(stage_, TraceTicks() - start_);
+        }
+    }
+private:
+    TraceTimer(const TraceTimer&) = delete;
+    TraceTimer& operator=(const TraceTimer&) = delete;
+    QueryTrace *trace_;
+    TraceStage stage_;
+    uint64_t start_;
+};
+
+} // namespace cloris
+
+#endif // CLORIS_QUERY_TRACE_H_
@@ -0,0 +1,44 @@
+//
+// read-write lock and its scoped guards
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_RWLOCK_H_
+#define CLORIS_RWLOCK_H_
+
+#include <pthread.h>
+#include <boost/noncopyable.hpp>
+
+namespace cloris {
+
+class RWLock : boost::noncopyable {
+public:
+    RWLock() { pthread_rwlock_init(&lock_, NULL); }
+    ~RWLock() { pthread_rwlock_destroy(&lock_); }
+    void ReadLock() { pthread_rwlock_rdlock(&lock_); }
+    void WriteLock() { pthread_rwlock_wrlock(&lock_); }
+    void Unlock() { pthread_rwlock_unlock(&lock_); }
+private:
+    pthread_rwlock_t lock_;
+};
+
+// a NULL lock makes the guards no-op, for callers which lock only on demand
+class ReadGuard : boost::noncopyable {
+public:
+    explicit ReadGuard(RWLock *lock) : lock_(lock) { if (lock_) { lock_->ReadLock(); } }
+    ~ReadGuard() { if (lock_) { lock_->Unlock(); } }
+private:
+    RWLock *lock_;
+};
+
+class WriteGuard : boost::noncopyable {
+public:
+    explicit WriteGuard(RWLock *lock) : lock_(lock) { if (lock_) { lock_->WriteLock(); } }
+    ~WriteGuard() { if (lock_) { lock_->Unlock(); } }
+private:
+    RWLock *lock_;
+};
+
+} // namespace cloris
+
+#endif // CLORIS_RWLOCK_H_
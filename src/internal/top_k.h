@@ -0,0 +1,113 @@
+//
+// bounded heap of the best scored docs for top-k search
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#ifndef CLORIS_TOP_K_H_
+#define CLORIS_TOP_K_H_
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cloris {
+
+// score of a matched doc, higher is better
+typedef std::function<double(int docid)> ScoreFunction;
+// upper bound of the scores of the docs in the partition of conjunction size
+// 'conjunctions', +inf if unknown
+typedef std::function<double(size_t conjunctions)> PartitionBound;
+
+//
+// min-heap of at most k (docid, score) pairs, the worst on top, so a doc is
+// rejected with one compare once the heap is full. Ties go to the smaller
+// docid. A doc matched in several partitions is kept once with its best
+// score, so the heap keeps the position of every doc to move it up
+//
+class TopKHeap {
+public:
+    explicit TopKHeap(size_t k) : k_(k) { heap_.reserve(k); }
+    inline bool full() const { return heap_.size() >= k_; }
+    inline size_t size() const { return heap_.size(); }
+    // the score to beat, -inf until the heap is full
+    inline double threshold() const {
+        return full() && k_ ? heap_.front().second : -std::numeric_limits<double>::infinity();
+    }
+    bool Push(int docid, double score) {
+        std::pair<int, double> doc(docid, score);
+        if (k_ == 0 || score != score || (full() && !Better(doc, heap_.front()))) {
+            return false;
+        }
+        auto iter = positions_.find(docid);
+        if (iter != positions_.end()) {
+            size_t pos = iter->second;
+            if (!Better(doc, heap_[pos])) {
+                return false;
+            }
+            heap_[pos].second = score;
+            SiftDown(pos);
+            return true;
+        }
+        if (full()) {
+            positions_.erase(heap_.front().first);
+            heap_.front() = doc;
+            positions_[docid] = 0;
+            SiftDown(0);
+        } else {
+            heap_.push_back(doc);
+            positions_[docid] = heap_.size() - 1;
+            SiftUp(heap_.size() - 1);
+        }
+        return true;
+    }
+    // the docs by score descending, the heap is left empty
+    std::vector<std::pair<int, double>> Take() {
+        std::vector<std::pair<int, double>> ret;
+        ret.swap(heap_);
+        positions_.clear();
+        std::sort(ret.begin(), ret.end(), Better);
+        return ret;
+    }
+private:
+    static bool Better(const std::pair<int, double>& a, const std::pair<int, double>& b) {
+        return (a.second > b.second) || (a.second == b.second && a.first < b.first);
+    }
+    void Swap(size_t i, size_t j) {
+        std::swap(heap_[i], heap_[j]);
+        positions_[heap_[i].first] = i;
+        positions_[heap_[j].first] = j;
+    }
+    // a worse doc goes up to the top
+    void SiftUp(size_t i) {
+        while (i > 0 && Better(heap_[(i - 1) / 2], heap_[i])) {
+            Swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    // a better doc goes down to the leaves
+    void SiftDown(size_t i) {
+        for (;;) {
+            size_t worst = i;
+            for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap_.size(); ++c) {
+                if (Better(heap_[worst], heap_[c])) {
+                    worst = c;
+                }
+            }
+            if (worst == i) {
+                return;
+            }
+            Swap(i, worst);
+            i = worst;
+        }
+    }
+    size_t k_;
+    std::vector<std::pair<int, double>> heap_;
+    std::unordered_map<int, size_t> positions_; // docid ==> index in heap_
+};
+
+} // namespace cloris
+
+#endif // CLORIS_TOP_K_H_
@@ -5,10 +5,21 @@
 // Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
 //
 
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 #include "internal/log.h"
+#include "forward_index.h"
+#include "indexer/geo_indexer.h"
+#include "indexer/indexer_factory.h"
 #include "indexer/indexer_manager.h"
 #include "inverted_index.h"
 
+// nearest search starts from this radius and doubles it until enough docs are found
+#define KNN_START_RADIUS    1000.0
+// half of the earth circumference, every point is within it
+#define KNN_MAX_RADIUS      20037509.0
+
 namespace cloris {
 
 static size_t get_dnf_size(const Disjunction& disjunction) {
@@ -57,18 +68,24 @@ bool InvertedIndex::Init(const IndexSchema& schema, std::string& err_msg) {
     bool is_first_loop = true;
     for (auto& term : schema.terms()) {
         if (tmp_set.find(term.name()) == tmp_set.end()) {
+            std::shared_ptr<GeoCaches> geo_caches = IndexerFactory::instance()->CreateGeoCaches(term);
+            if (geo_caches) {
+                geo_caches_[term.name()] = geo_caches;
+            }
             for (size_t i = 0; i < table_size; ++i) {
                 if (is_first_loop) {
                     
                     new(&itable_[i]) IndexerManager(i);
                 }
-                cLog(DEBUG, "declare term: %s, index=%d", term.name().c_str(), i);
-                itable_[i].DeclareTerm(term);
+                cLog(DEBUG, "declare term: %s, index=%zu", term.name().c_str(), i);
+                itable_[i].DeclareTerm(term, geo_caches.get());
             }
             tmp_set.insert(term.name());
         }
         is_first_loop = false;
     }
+    partition_max_.resize(table_size);
+    partition_unbounded_.resize(table_size, false);
     return true;
 }
 
@@ -76,8 +93,28 @@ bool InvertedIndex::Init(const IndexSchema& schema, std::string& err_msg) {
 // DNF: (A ^ B ^ C) v (A ^ D), the first step is to cut this expression into
 // A ^ B ^ C and A ^ D, then add them into the inverted list one by one 
 bool InvertedIndex::Add(const DNF& dnf, bool is_incremental) {
+    // docs out of the forward index range have no score to bound
+    int docid = dnf.docid();
+    if (docid >= 0 && docid < FORWARD_MAX_DOCID) {
+        if (static_cast<size_t>(docid) >= added_docs_.size()) {
+            added_docs_.resize(docid + 1, false);
+        } else if (added_docs_[docid]) {
+            // its old postings may sit in any partition
+            std::fill(partition_unbounded_.begin(), partition_unbounded_.end(), true);
+        }
+        added_docs_[docid] = true;
+    }
     for (auto& disjunction : dnf.disjunctions()) {
-        this->Add(disjunction, dnf.docid(), is_incremental);
+        size_t conj_size = get_dnf_size(disjunction);
+        itable_[conj_size].Add(disjunction, dnf.docid(), is_incremental);
+        // bounds of the partition for top-k search
+        for (auto& attr : dnf.attributes()) {
+            if (attr.has_dval() || attr.has_ival()) {
+                double value = attr.has_dval() ? attr.dval() : static_cast<double>(attr.ival());
+                auto iter = partition_max_[conj_size].insert(std::make_pair(attr.name(), value)).first;
+                iter->second = std::max(iter->second, value);
+            }
+        }
     } 
     return true;
 }
@@ -87,9 +124,52 @@ bool InvertedIndex::Add(const Disjunction& disjunction, int docid, bool is_incre
     size_t conj_size = get_dnf_size(disjunction);
     IndexerManager& manager = itable_[conj_size];
     manager.Add(disjunction, docid, is_incremental);
+    partition_unbounded_[conj_size] = true;
     return true;
 }
 
+// snapshot every indexer for read-mostly serving, Add is still allowed
+// afterwards but makes the touched indexer fall back to its dynamic structure
+void InvertedIndex::Compile() {
+    for (size_t i = 0; i <= terms_.size(); ++i) {
+        itable_[i].Compile();
+    }
+}
+
+size_t InvertedIndex::Compact() {
+    size_t merged = 0;
+    for (size_t i = 0; i <= terms_.size(); ++i) {
+        merged += itable_[i].Compact();
+    }
+    return merged;
+}
+
+void InvertedIndex::GetStats(MetricsSnapshot& snapshot) const {
+    std::unordered_map<std::string, IndexerStats> stats;
+    snapshot.zero_postings = 0;
+    for (size_t i = 0; i <= terms_.size(); ++i) {
+        itable_[i].GetStats(stats);
+        snapshot.zero_postings += itable_[i].zero_postings();
+    }
+    snapshot.indexers.clear();
+    for (auto& name : terms_) {
+        if (stats.find(name) != stats.end()) {
+            snapshot.indexers.push_back(stats[name]);
+        }
+    }
+}
+
+void InvertedIndex::set_metrics(Metrics *metrics) {
+    if (metrics) {
+        for (auto& name : terms_) {
+            metrics->DeclareField(name);
+        }
+    }
+    for (size_t i = 0; i <= terms_.size(); ++i) {
+        itable_[i].set_metrics(metrics);
+    }
+}
+
 // TODO
 bool InvertedIndex::Update(DNF *dnf, int docid) {
     return true;
@@ -111,17 +191,155 @@ void InvertedIndex::GetStandardQuery(const Query& query, Query& std_query) {
 }
 
 // TODO
-std::vector<int> InvertedIndex::Search(const Query& query, int limit) {
+std::vector<int> InvertedIndex::Search(const Query& query, int limit, QueryTrace *trace) {
+    uint64_t start = trace ? TraceTicks() : 0;
     std::vector<int> response;
     Query std_query;
     // clean unexisted key
-    this->GetStandardQuery(query, std_query);
+    {
+        TraceTimer timer(trace, TS_STD_QUERY);
+        this->GetStandardQuery(query, std_query);
+    }
     for (int i = static_cast<int>(std_query.size()); i >= 0; --i) {
-        std::vector<int> tmp_vec = itable_[i].Search(std_query, limit);
+        std::vector<int> tmp_vec = itable_[i].Search(std_query, limit, trace);
+        TraceTimer timer(trace, TS_MERGE);
         for (auto &p : tmp_vec) {
             response.push_back(p);
         }
     }
+    if (trace) {
+        trace->set_total_ticks(TraceTicks() - start);
+    }
+    return response;
+}
+
+std::vector<std::pair<int, double>> InvertedIndex::SearchTopK(const Query& query, size_t k,
+        const ScoreFunction& score, const PartitionBound& bound, QueryTrace *trace) {
+    uint64_t start = trace ? TraceTicks() : 0;
+    Query std_query;
+    {
+        TraceTimer timer(trace, TS_STD_QUERY);
+        this->GetStandardQuery(query, std_query);
+    }
+    auto search = [&std_query, &score, trace](IndexerManager& manager, TopKHeap& heap) {
+        manager.SearchTopK(std_query, score, heap, trace);
+    };
+    std::vector<std::pair<int, double>> response = this->SearchPartitions(std_query, k, bound, search, trace);
+    if (trace) {
+        trace->set_total_ticks(TraceTicks() - start);
+    }
+    return response;
+}
+
+std::vector<std::pair<int, double>> InvertedIndex::SearchWeighted(const Query& query, size_t k, QueryTrace *trace) {
+    uint64_t start = trace ? TraceTicks() : 0;
+    Query std_query;
+    {
+        TraceTimer timer(trace, TS_STD_QUERY);
+        this->GetStandardQuery(query, std_query);
+    }
+    auto bound = [this, &std_query](size_t conjunctions) {
+        return itable_[conjunctions].WeightBound(std_query);
+    };
+    auto search = [&std_query, trace](IndexerManager& manager, TopKHeap& heap) {
+        manager.SearchWeighted(std_query, heap, trace);
+    };
+    std::vector<std::pair<int, double>> response = this->SearchPartitions(std_query, k, bound, search, trace);
+    if (trace) {
+        trace->set_total_ticks(TraceTicks() - start);
+    }
+    return response;
+}
+
+//
+// partitions with the highest bound go first, so the k-th score rises early
+// and the remaining partitions are cut as a whole once they can't beat it
+//
+std::vector<std::pair<int, double>> InvertedIndex::SearchPartitions(const Query& std_query, size_t k,
+        const PartitionBound& bound, const PartitionSearch& search, QueryTrace *trace) {
+    std::vector<std::pair<double, size_t>> partitions; // bound, conjunction size
+    for (int i = static_cast<int>(std_query.size()); i >= 0; --i) {
+        double upper = bound ? bound(i) : std::numeric_limits<double>::infinity();
+        partitions.push_back(std::make_pair(upper, static_cast<size_t>(i)));
+    }
+    std::stable_sort(partitions.begin(), partitions.end(),
+        [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+            return a.first > b.first;
+        });
+    TopKHeap heap(k);
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        // a doc scoring exactly the bound may still win the tie by docid
+        if (partitions[i].first < heap.threshold()) {
+            if (trace) {
+                trace->AddPrunedPartitions(partitions.size() - i);
+            }
+            break;
+        }
+        search(itable_[partitions[i].second], heap);
+    }
+    TraceTimer timer(trace, TS_MERGE);
+    return heap.Take();
+}
+
+double InvertedIndex::PartitionMax(size_t conjunctions, const std::string& name) const {
+    if (conjunctions >= partition_max_.size() || partition_unbounded_[conjunctions]) {
+        return std::numeric_limits<double>::infinity();
+    }
+    auto iter = partition_max_[conjunctions].find(name);
+    return (iter == partition_max_[conjunctions].end()) ? -std::numeric_limits<double>::infinity() : iter->second;
+}
+
+//
+// the radius doubles every round, so the rounds cost about as much as the
+// last one, and the last radius is at most twice the distance of the n-th
+// doc instead of a large fixed radius fetching everything around. Every
+// round matches the query at its radius and looks up the distances of the
+// matched docs only
+//
+std::vector<std::pair<int, double>> InvertedIndex::SearchNearest(const Query& query, const std::string& name, size_t n,
+        QueryTrace *trace) {
+    std::vector<std::pair<int, double>> response;
+    Query std_query;
+    this->GetStandardQuery(query, std_query);
+    if (n == 0 || !std_query.has(name) || std_query.at(name).type() != ValueType::GEORANGE) {
+        cLog(WARN, "[inverted_index] nearest search needs a geo term %s", name.c_str());
+        return response;
+    }
+    Term& geo = std_query.at(name);
+    double longitude = geo.longitude();
+    double latitude = geo.latitude();
+    double max_radius = (geo.radius() > 0) ? geo.radius() : KNN_MAX_RADIUS;
+    std::vector<int> matched;
+    for (double radius = std::min(KNN_START_RADIUS, max_radius); ; radius = std::min(radius * 2, max_radius)) {
+        geo = GeoRange(longitude, latitude, radius);
+        matched.clear();
+        for (int i = static_cast<int>(std_query.size()); i >= 0; --i) {
+            std::vector<int> docids = itable_[i].Search(std_query, -1, trace);
+            matched.insert(matched.end(), docids.begin(), docids.end());
+        }
+        // a doc may keep its location in a manager other than the matching one
+        std::unordered_map<int, double> distances;
+        if (!matched.empty()) {
+            for (size_t i = 0; i <= terms_.size(); ++i) {
+                itable_[i].GetDistances(geo, matched, distances);
+            }
+        }
+        response.assign(distances.begin(), distances.end());
+        if (trace) {
+            trace->AddNearestRound();
+        }
+        cLog(DEBUG, "[inverted_index] nearest search, radius=%f, found=%zu", radius, response.size());
+        if (response.size() >= n || radius >= max_radius) {
+            break;
+        }
+    }
+    std::sort(response.begin(), response.end(), 
+        [](const std::pair<int, double>& a, const std::pair<int, double>& b) {
+            return (a.second < b.second) || (a.second == b.second && a.first < b.first);
+        });
+    if (response.size() > n) {
+        response.resize(n);
+    }
     return response;
 }
 
@@ -8,14 +8,23 @@
 #ifndef CLORIS_INVERTED_INDEX_H_
 #define CLORIS_INVERTED_INDEX_H_
 
+#include <functional>
+#include <memory>
 #include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include "index_schema.pb.h"
 #include "inverted_index.pb.h"
+#include "internal/metrics.h"
+#include "internal/query_trace.h"
+#include "internal/top_k.h"
 #include "query.h"
 
 namespace cloris {
 
 class IndexerManager;
+struct GeoCaches;
 
 class InvertedIndex {
 public:
@@ -27,13 +36,56 @@ public:
     bool Add(const Disjunction& disjunction, int docid, bool is_incremental);
     bool Update(DNF *dnf, int docid);
     bool Del(int docid);
-    std::vector<int> Search(const Query& query, int limit);
+    // stages of the search are timed into 'trace' if it is not NULL
+    std::vector<int> Search(const Query& query, int limit, QueryTrace *trace = NULL);
+    // the 'n' matched docs nearest to the point of geo term 'name', as (docid,
+    // distance in meter) pairs sorted by distance. The radius of the term caps
+    // the search, 0 means no cap. Docs without a location are not returned.
+    // The radius rounds are counted in 'trace' if it is not NULL
+    std::vector<std::pair<int, double>> SearchNearest(const Query& query, const std::string& name, size_t n,
+            QueryTrace *trace = NULL);
+    // the 'k' best matched docs by 'score' as (docid, score) pairs, best first.
+    // Partitions are searched by descending 'bound' and the rest are skipped
+    // once the k-th score is above the bound, an empty 'bound' skips none
+    std::vector<std::pair<int, double>> SearchTopK(const Query& query, size_t k, const ScoreFunction& score,
+            const PartitionBound& bound, QueryTrace *trace = NULL);
+    // the 'k' best matched docs by weight as (docid, score) pairs, best first.
+    // A match scores the sum over its k best query terms of the term weight
+    // times the weight of the doc conjunction on that field, see
+    // Conjunction.weight. Partitions and docs that can't reach the k-th score
+    // are skipped
+    std::vector<std::pair<int, double>> SearchWeighted(const Query& query, size_t k, QueryTrace *trace = NULL);
+    // the largest value of numeric attribute 'name' of the docs added to the
+    // partition of conjunction size 'conjunctions', docs without it are not
+    // counted, -inf if none has it. +inf once docs were added without their
+    // attributes by Add(disjunction). A docid added again may keep postings
+    // in other partitions, so that makes every partition +inf
+    double PartitionMax(size_t conjunctions, const std::string& name) const;
+    void Compile();
+    size_t Compact();
+    // fill the index sizes of 'snapshot', fields are sorted by name
+    void GetStats(MetricsSnapshot& snapshot) const;
+    // time posting list fetches per field into 'metrics', NULL turns it off
+    void set_metrics(Metrics *metrics);
     void GetStandardQuery(const Query& query, Query& std_query);
 private:
+    typedef std::function<void(IndexerManager& manager, TopKHeap& heap)> PartitionSearch;
+    // search the partitions of 'std_query' by descending 'bound' into a heap
+    // of 'k', see SearchTopK
+    std::vector<std::pair<int, double>> SearchPartitions(const Query& std_query, size_t k, const PartitionBound& bound,
+            const PartitionSearch& search, QueryTrace *trace);
+
     std::set<std::string> terms_; // age, sex, city...
     int max_conj_;
     // 10 mean the max -- is 10
     IndexerManager *itable_;
+    // per partition, the max of every numeric attribute of its docs
+    std::vector<std::unordered_map<std::string, double>> partition_max_;
+    std::vector<bool> partition_unbounded_;
+    // by docid, the docs added by Add(dnf)
+    std::vector<bool> added_docs_;
+    // caches of the geo terms, by name
+    std::unordered_map<std::string, std::shared_ptr<GeoCaches>> geo_caches_;
 };
 
 } // namespace cloris
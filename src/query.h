@@ -29,6 +29,7 @@ public:
     Term& at(const std::string& key);
     void Append(const Term& term);
     size_t size() const { return terms_.size(); }
+    bool has(const std::string& key) const { return terms_.find(key) != terms_.end(); }
 private:
     std::map<std::string, Term> terms_;
 };
@@ -35,12 +35,12 @@ Term::Term(const std::string& name, const std::string& val) : name_(name) {
     size_ = val.size();
 }
 
-Term::Term(const Term& t) {
-    name_ = t.name();
-    type_ = t.type();
-    size_ = t.size();
-    value_.reserve(size_);
-    memcpy(&value_[0], t.data(), size_);
+Term::Term(const Term& t) 
+    : type_(t.type()),
+      name_(t.name()),
+      size_(t.size()),
+      value_(t.value()),
+      weight_(t.weight()) {
 }
 
 //
@@ -87,7 +87,7 @@ Term::Term(const std::string& name, double left, double right, int32_t flag) : n
 //
 Term::Term(const std::string& name, const std::string& left, const std::string& right, int32_t flag) : name_(name) {
     size_t len = sizeof(char) + sizeof(size_t) * 2 + left.length() + right.length();
-    value_.reserve(len);
+    value_.resize(len);
     value_[0] = flag & INTERVAL_FLAG_MASK;
     *(reinterpret_cast<size_t*>(&value_[sizeof(char)])) = left.length();
     memcpy(&value_[sizeof(char) + sizeof(size_t)], left.data(), left.length());
@@ -103,7 +103,7 @@ Term::Term(const std::string& name, const std::string& left, const std::string&
 // | longitude | latitude | radius  |
 Term::Term(const GeoRange& geo_range) {
     size_t len = sizeof(double) * 3;
-    value_.reserve(len);
+    value_.resize(len);
     *(reinterpret_cast<double*>(&value_[0])) = geo_range.longitude;
     *(reinterpret_cast<double*>(&value_[sizeof(double)])) = geo_range.latitude;
     *(reinterpret_cast<double*>(&value_[sizeof(double) * 2])) = geo_range.radius;
@@ -113,7 +113,7 @@ Term::Term(const GeoRange& geo_range) {
 
 Term& Term::operator=(const GeoRange& geo_range) {
     size_t len = sizeof(double) * 3;
-    value_.reserve(len);
+    value_.resize(len);
     *(reinterpret_cast<double*>(&value_[0])) = geo_range.longitude;
     *(reinterpret_cast<double*>(&value_[sizeof(double)])) = geo_range.latitude;
     *(reinterpret_cast<double*>(&value_[sizeof(double) * 2])) = geo_range.radius;
@@ -122,6 +122,36 @@ Term& Term::operator=(const GeoRange& geo_range) {
     return *this;
 }
 
+//
+// the encoding of geo fence is
+// | uint64_t |   double   |   double  | ... |
+// |    id    | longitude1 | latitude1 | ... |
+Term::Term(const GeoFence& geo_fence) {
+    this->operator=(geo_fence);
+}
+
+Term& Term::operator=(const GeoFence& geo_fence) {
+    size_t len = sizeof(uint64_t) + sizeof(double) * 2 * geo_fence.points.size();
+    value_.resize(len);
+    *(reinterpret_cast<uint64_t*>(&value_[0])) = geo_fence.id;
+    double *p = reinterpret_cast<double*>(&value_[sizeof(uint64_t)]);
+    for (auto& point : geo_fence.points) {
+        *p++ = point.first;
+        *p++ = point.second;
+    }
+    type_ = ValueType::GEOFENCE;
+    size_ = len;
+    return *this;
+}
+
+void Term::GetFencePoints(std::vector<std::pair<double, double>>& points) const {
+    size_t n = (value_.size() - sizeof(uint64_t)) / (sizeof(double) * 2);
+    const double *p = reinterpret_cast<const double*>(&value_[sizeof(uint64_t)]);
+    for (size_t i = 0; i < n; ++i, p += 2) {
+        points.push_back(std::make_pair(p[0], p[1]));
+    }
+}
+
 Term& Term::operator=(int32_t val) {
     if (value_.size() > sizeof(int32_t)) {
         value_.resize(sizeof(int32_t));
@@ -249,6 +279,14 @@ std::string Term::print() const {
             ss << "\"latitude\":"   << *reinterpret_cast<const double*>(&value_[sizeof(double)]) << ", ";
             ss << "\"radius\":"     << *reinterpret_cast<const double*>(&value_[sizeof(double) * 2]) << "}";
             break;
+        case GEOFENCE:
+            ss << "{\"id\":" << *reinterpret_cast<const uint64_t*>(&value_[0]) << ", \"points\":[";
+            for (size_t pos = sizeof(uint64_t); pos + sizeof(double) * 2 <= value_.size(); pos += sizeof(double) * 2) {
+                ss << ((pos == sizeof(uint64_t)) ? "[" : ", [") << *reinterpret_cast<const double*>(&value_[pos]) << ", "
+                    << *reinterpret_cast<const double*>(&value_[pos + sizeof(double)]) << "]";
+            }
+            ss << "]}";
+            break;
         default:
             ss << "BAD_TERM";
             break;
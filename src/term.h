@@ -7,9 +7,12 @@
 #ifndef CLORISEARCH_TERM_H_
 #define CLORISEARCH_TERM_H_
 
+#include <stdint.h>
 #include <cstring>
 #include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #define INTERVAL_TYPE_MASK  0x00010000
 #define INTERVAL_FLAG_MASK  0x00000003
@@ -31,6 +34,7 @@ enum ValueType {
     DOUBLE_INTERVAL = 0x00010004,
     STRING_INTERVAL = 0x00010008,
     MAX_INTERVAL_TYPE = 0x00010008,
+    GEOFENCE = 0x00020000,
 };
 
 struct  GeoRange {
@@ -40,6 +44,15 @@ struct  GeoRange {
     double radius; // in meter
 };
 
+// polygon of a geo query, searches with the same non-zero id reuse the cell
+// covering computed for the first one, so an id must always name the same points
+struct GeoFence {
+    GeoFence(uint64_t _id = 0) : id(_id) {}
+    void AddPoint(double lon, double lat) { points.push_back(std::make_pair(lon, lat)); }
+    uint64_t id;
+    std::vector<std::pair<double, double>> points; // (lon, lat) in order
+};
+
 class Term {
 public:
     Term(const std::string&);
@@ -48,6 +61,7 @@ public:
     Term(const std::string&, const std::string&);
     Term(const Term& t);
     Term(const GeoRange& geo_range);
+    Term(const GeoFence& geo_fence);
     // Interval Expression and Encoding
     Term(const std::string&, int32_t, int32_t, int32_t);
     Term(const std::string&, double, double, int32_t);
@@ -59,6 +73,7 @@ public:
     Term& operator=(const char* val);
     Term& operator=(const std::string& val);
     Term& operator=(const GeoRange& geo_range);
+    Term& operator=(const GeoFence& geo_fence);
     bool operator==(const Term& t) const;
 
     ValueType type() const { return type_; }
@@ -71,11 +86,17 @@ public:
     double longitude() const { return *reinterpret_cast<const double*>(&value_[0]); }
     double latitude()  const { return *reinterpret_cast<const double*>(&value_[sizeof(double)]); }
     double radius()   const { return *reinterpret_cast<const double*>(&value_[sizeof(double) * 2]); }
+    // used only for GEOFENCE type
+    uint64_t fence_id() const { return *reinterpret_cast<const uint64_t*>(&value_[0]); }
+    void GetFencePoints(std::vector<std::pair<double, double>>& points) const;
     std::string print() const;
 
     // unsafe method, used only for XX_INTERVAL type
     int32_t flag() const { char p = value_[0]; return p; }
     size_t size() const { return size_; }
+    // weight of the term in weighted search, kept when the value is reassigned
+    double weight() const { return weight_; }
+    Term& set_weight(double weight) { weight_ = weight; return *this; }
 
 private:
     Term() = delete;
@@ -83,6 +104,7 @@ private:
     std::string name_;
     size_t size_;
     std::string value_;
+    double weight_ = 1.0;
 };
 
 struct TermHash {
@@ -0,0 +1,86 @@
+//
+// nearest search test: a dense area of non-matching points around the query
+// and a few matching points far away
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <iostream>
+#include "clorisearch.h"
+
+using namespace cloris;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cout << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+        ++g_failed; \
+    } \
+} while (0)
+
+static int g_failed = 0;
+
+static const char* g_index_schema = "{\"terms\":["
+    "{\"name\":\"location\",\"key_type\":\"double\",\"index_type\":\"geo\"},"
+    "{\"name\":\"city\",\"key_type\":\"string\",\"index_type\":\"simple\"}]}";
+
+static const double g_lon = 116.4;
+static const double g_lat = 39.9;
+
+static bool AddDoc(CloriSearch& sch, int docid, double lon, double lat, const char *city) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "{\"mode\":\"s\",\"docid\":%d,\"disjunctions\":[{\"conjunctions\":["
+            "{\"name\":\"location\",\"value\":{\"geo\":{\"lon\":%.7f,\"lat\":%.7f}}},"
+            "{\"name\":\"city\",\"value\":{\"sval\":[\"%s\"]}}]}]}", docid, lon, lat, city);
+    return sch.Add(buf, ISF_JSON);
+}
+
+// 1 degree of latitude is about 111.2km
+static void CheckNearest(CloriSearch& sch, double radius, size_t n, size_t found, uint64_t rounds) {
+    Query query;
+    query["location"] = GeoRange(g_lon, g_lat, radius);
+    query["city"] = "beijing";
+    QueryTrace trace;
+    std::vector<std::pair<int, double>> response = sch.SearchNearest(query, "location", n, &trace);
+    CHECK(response.size() == found);
+    for (size_t i = 0; i < response.size(); ++i) {
+        CHECK(response[i].first == static_cast<int>(10001 + i));
+        CHECK(fabs(response[i].second - 5000.0 * (1 << i)) < 50.0);
+    }
+    CHECK(trace.nearest_rounds() == rounds);
+}
+
+int main() {
+    CloriSearch sch;
+    if (!sch.Init(g_index_schema, ISF_JSON)) {
+        std::cout << "cloriSearch init failed" << std::endl;
+        return 1;
+    }
+    // 10000 points of another city within 500m of the query
+    int docid = 1;
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 100; ++j) {
+            CHECK(AddDoc(sch, docid++, g_lon + (i - 50) * 0.00005, g_lat + (j - 50) * 0.00005, "shanghai"));
+        }
+    }
+    // matching points 5km, 10km and 20km to the north
+    for (int i = 0; i < 3; ++i) {
+        CHECK(AddDoc(sch, 10001 + i, g_lon, g_lat + 5000.0 * (1 << i) / 111195.0, "beijing"));
+    }
+
+    for (int compiled = 0; compiled < 2; ++compiled) {
+        // rounds of 1, 2, 4, 8 and 16km
+        CheckNearest(sch, 0, 2, 2, 5);
+        CheckNearest(sch, 0, 3, 3, 6);
+        // the 8km round finds one and 16km is cut to the 12km cap
+        CheckNearest(sch, 12000, 2, 2, 5);
+        CheckNearest(sch, 7000, 2, 1, 4);
+        sch.Compile();
+    }
+    if (g_failed > 0) {
+        std::cout << g_failed << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "nearest search test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,71 @@
+//
+// weighted search test: a doc matched in two partitions keeps its best score
+// when that one comes from the partition searched last
+// Copyright (C) 2018 James Wei (weijianlhp@163.com). All rights reserved
+//
+
+#include <math.h>
+#include <iostream>
+#include "clorisearch.h"
+
+using namespace cloris;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cout << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+        ++g_failed; \
+    } \
+} while (0)
+
+static int g_failed = 0;
+
+static const char* g_index_schema = "{\"terms\":["
+    "{\"name\":\"city\",\"key_type\":\"string\",\"index_type\":\"simple\"},"
+    "{\"name\":\"os\",\"key_type\":\"string\",\"index_type\":\"simple\"}]}";
+
+static bool AddDoc(CloriSearch& sch, int docid, const std::string& disjunctions) {
+    return sch.Add("{\"mode\":\"m\",\"docid\":" + std::to_string(docid) + ",\"disjunctions\":[" + disjunctions + "]}",
+            ISF_JSON);
+}
+
+static std::string City(double weight) {
+    return "{\"name\":\"city\",\"weight\":" + std::to_string(weight) + ",\"value\":{\"sval\":[\"beijing\"]}}";
+}
+
+static std::string Os(double weight) {
+    return "{\"name\":\"os\",\"weight\":" + std::to_string(weight) + ",\"value\":{\"sval\":[\"ios\"]}}";
+}
+
+int main() {
+    CloriSearch sch;
+    if (!sch.Init(g_index_schema, ISF_JSON)) {
+        std::cout << "cloriSearch init failed" << std::endl;
+        return 1;
+    }
+    // partition 1 is bounded by 10 and searched first, doc 3 scores 1 there
+    // and 6 in partition 2, which is bounded by 6
+    CHECK(AddDoc(sch, 1, "{\"conjunctions\":[" + City(10) + "]}"));
+    CHECK(AddDoc(sch, 2, "{\"conjunctions\":[" + City(2) + "]}"));
+    CHECK(AddDoc(sch, 3, "{\"conjunctions\":[" + City(1) + "]},{\"conjunctions\":[" + City(3) + "," + Os(3) + "]}"));
+
+    Query query;
+    query["city"] = "beijing";
+    query["os"] = "ios";
+    for (size_t k = 2; k <= 3; ++k) {
+        std::vector<std::pair<int, double>> response = sch.SearchWeighted(query, k);
+        CHECK(response.size() == k);
+        if (response.size() == k) {
+            CHECK(response[0].first == 1 && fabs(response[0].second - 10) < 1e-6);
+            CHECK(response[1].first == 3 && fabs(response[1].second - 6) < 1e-6);
+            if (k == 3) {
+                CHECK(response[2].first == 2 && fabs(response[2].second - 2) < 1e-6);
+            }
+        }
+    }
+    if (g_failed > 0) {
+        std::cout << g_failed << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "weighted search test passed" << std::endl;
+    return 0;
+}